@@ -32,10 +32,36 @@
 enum cra_cpuid_bits {
 	CRA_CPUID_FUNC_BASIC_HIGHEST	= 0x00000000,
 	CRA_CPUID_FUNC_BASIC_FEATURES	= 0x00000001,
+	CRA_CPUID_FUNC_STRUCT_FEATURES	= 0x00000007,
 	CRA_CPUID_FUNC_EXT_HIGHEST	= 0x80000000,
 	CRA_CPUID_FUNC_EXT_FEATURES	= 0x80000001,
+	CRA_CPUID_FUNC_EXT_SIZES	= 0x80000008,
 	CRA_CPUID_FEAT_BASIC_PSE	= 0x00000008,
+	CRA_CPUID_FEAT_BASIC_SSE2	= 0x04000000,
+	CRA_CPUID_FEAT_BASIC_OSXSAVE	= 0x08000000,
+	CRA_CPUID_FEAT_BASIC_AVX	= 0x10000000,
+	CRA_CPUID_FEAT_BASIC_RDRAND	= 0x40000000,
 	CRA_CPUID_FEAT_EXT_PDPE1G	= 0x04000000,
+	CRA_CPUID_FEAT_EXT_CLZERO	= 0x00000001,
+	CRA_CPUID_FEAT_STRUCT_AVX2	= 0x00000020,
+	CRA_CPUID_FEAT_STRUCT_ERMS	= 0x00000200,
+	CRA_CPUID_FEAT_STRUCT_AVX512F	= 0x00010000,
+};
+
+/**
+ * cr_amd64_rdrand() retries before giving up
+ */
+#define CRA_RDRAND_RETRIES		10
+
+/**
+ * Extended Control Register 0 (XCR0) state component bits, as per:
+ * Intel 64 and IA-32 Architectures Software Developer’s Manual, Volume 1
+ * Section 13.3, pages 13-5-13-6.
+ */
+enum cra_xcr0_bits {
+	CRA_XCR0_SSE			= 0x02,
+	CRA_XCR0_AVX			= 0x04,
+	CRA_XCR0_AVX512			= 0xe0,
 };
 
 /*
@@ -142,6 +168,18 @@ struct cra_idt_ent {
 	unsigned long		offset16_63:48;
 	unsigned		zero5_36:32;
 } __attribute__((packed));
+
+/**
+ * Exception and interrupt vectors, as per:
+ * AMD64 Architecture Programmer’s Manual, Volume 2: System Programming
+ * Section 8.2.
+ */
+enum cra_vec {
+	CRA_VEC_NMI		= 0x02,
+	CRA_VEC_GP		= 0x0d,
+	CRA_VEC_PF		= 0x0e,
+	CRA_VEC_MC		= 0x12,
+};
 #define CRA_INIT_IDTE(idte, _offset, _selector, _ist, _attr) do {\
 		(idte)->offset0_15 = (_offset) & 0xffff;	\
 		(idte)->selector = (_selector);			\
@@ -166,6 +204,14 @@ struct cra_idtr_bits {
 		(idtr)->base = (_base);				\
 	} while (0)
 
+/**
+ * FS and GS segment base registers in Long Mode, as per:
+ * AMD64 Architecture Programmer’s Manual, Volume 2: System Programming
+ * Section 4.5.3, page 72.
+ */
+#define CRA_FS_BASE_MSR		0xc0000100
+#define CRA_GS_BASE_MSR		0xc0000101
+
 /**
  * Exception low-level vector 0x{00-12} wrapper macros
  */
@@ -195,17 +241,146 @@ struct cra_idtr_bits {
 
 
 
+/**
+ * Zero-filling kernels
+ * Each kernel zero-fills nbytes (a multiple of PAGE_SIZE) at a page-aligned
+ * va, keeping the current VA in %rdi and the remaining count, in units of
+ * (1 << rcx_shift) bytes, in %rcx whenever rip_restart is reached. This
+ * allows faulting stores to be resumed at the next page by restarting at
+ * rip_restart or to be abandoned by resuming at rip_done, which orders all
+ * preceding (non-temporal) stores.
+ */
+enum cra_clear_kernel_id {
+	CRA_CLEAR_STOSQ			= 0,
+	CRA_CLEAR_STOSB			= 1,
+	CRA_CLEAR_MOVNTI		= 2,
+	CRA_CLEAR_AVX2			= 3,
+	CRA_CLEAR_AVX512		= 4,
+	CRA_CLEAR_CLZERO		= 5,
+	CRA_CLEAR_KERNELS		= 6,
+};
+enum cra_clear_feat_bits {
+	CRA_CLEAR_FEAT_SSE2		= 0x01,
+	CRA_CLEAR_FEAT_ERMS		= 0x02,
+	CRA_CLEAR_FEAT_AVX2		= 0x04,
+	CRA_CLEAR_FEAT_AVX512F		= 0x08,
+	CRA_CLEAR_FEAT_CLZERO		= 0x10,
+};
+struct cra_clear_kernel {
+	int				id;		/* CRA_{CLEAR,FILL}_* */
+	const char *			name;
+	enum cra_clear_feat_bits	feat;
+	int				rcx_shift;
+	void *				rip_restart;
+	void *				rip_done;
+};
+#define CRA_DECL_CLEAR_KERNEL(name)				\
+	void cr_amd64_clear_##name(uintptr_t va, size_t nbytes);\
+	extern char cr_amd64_clear_##name##_restart[];		\
+	extern char cr_amd64_clear_##name##_done[]
+#define CRA_INIT_CLEAR_KERNEL(_id, _name, _feat, _rcx_shift) {	\
+		.id = (_id),					\
+		.name = #_name,					\
+		.feat = (_feat),				\
+		.rcx_shift = (_rcx_shift),			\
+		.rip_restart = cr_amd64_clear_##_name##_restart,\
+		.rip_done = cr_amd64_clear_##_name##_done,	\
+	}
+extern struct cra_clear_kernel cr_amd64_clear_kernels[CRA_CLEAR_KERNELS];
+
+/**
+ * Pattern-filling kernels
+ * Each kernel fills nbytes at va with a constant qword pattern or with
+ * the output of per-lane xorshift64 generators seeded from qword, as per
+ * the zero-filling kernel conventions above.
+ */
+enum cra_fill_kernel_id {
+	CRA_FILL_MOVNTI			= 0,
+	CRA_FILL_AVX2			= 1,
+	CRA_FILL_RANDOM_MOVNTI		= 2,
+	CRA_FILL_RANDOM_AVX2		= 3,
+	CRA_FILL_KERNELS		= 4,
+};
+#define CRA_DECL_FILL_KERNEL(name)				\
+	void cr_amd64_fill_##name(uintptr_t va, size_t nbytes, uint64_t qword);\
+	extern char cr_amd64_fill_##name##_restart[];		\
+	extern char cr_amd64_fill_##name##_done[]
+#define CRA_INIT_FILL_KERNEL(_id, _name, _feat) {		\
+		.id = (_id),					\
+		.name = #_name,					\
+		.feat = (_feat),				\
+		.rcx_shift = 0,					\
+		.rip_restart = cr_amd64_fill_##_name##_restart,	\
+		.rip_done = cr_amd64_fill_##_name##_done,	\
+	}
+extern struct cra_clear_kernel cr_amd64_fill_kernels[CRA_FILL_KERNELS];
+
+/**
+ * Verification kernels
+ * Each kernel tests one line of CRA_VERIFY_LINE_SIZE bytes every stride
+ * bytes from va up to va_limit for being all-zero and returns the VA of
+ * the first nonzero line found, or va_limit if none were found.
+ */
+#define CRA_VERIFY_LINE_SIZE		64
+enum cra_verify_kernel_id {
+	CRA_VERIFY_SSE2			= 0,
+	CRA_VERIFY_AVX2			= 1,
+	CRA_VERIFY_AVX512		= 2,
+};
+uintptr_t cr_amd64_verify_sse2(uintptr_t va, uintptr_t va_limit, size_t stride);
+uintptr_t cr_amd64_verify_avx2(uintptr_t va, uintptr_t va_limit, size_t stride);
+uintptr_t cr_amd64_verify_avx512(uintptr_t va, uintptr_t va_limit, size_t stride);
+
+/**
+ * Reset methods, each falling back to a triple fault after
+ * CRA_RESET_FALLBACK_US: PCH/ICH reset control register at port 0xcf9,
+ * ACPI FADT reset register in system I/O or PCI configuration space on
+ * bus 0, and the 8042 keyboard controller reset line pulse
+ */
+#define CRA_RESET_FALLBACK_US		10000
+enum cra_reset_method {
+	CRA_RESET_TRIPLE		= 0,
+	CRA_RESET_CF9			= 1,
+	CRA_RESET_ACPI			= 2,
+	CRA_RESET_8042			= 3,
+};
+enum cra_reset_space {
+	CRA_RESET_SPACE_IO		= 1,
+	CRA_RESET_SPACE_PCI		= 2,
+};
+struct cra_reset {
+	enum cra_reset_method	method;
+	enum cra_reset_space	acpi_space;
+	uint64_t		acpi_address;
+	uint8_t			acpi_value;
+};
+
 /*
  * AMD64-specific logic
  */
 
+void cr_amd64_clear(struct cra_clear_kernel *kernel, uintptr_t va, size_t nbytes);
+struct cra_clear_kernel *cr_amd64_clear_kernel_select(const char *name);
+enum cra_clear_feat_bits cr_amd64_cpuid_clear_features(void);
 size_t cr_amd64_cpuid_page_size_from_level(int level);
+void cr_amd64_fill(struct cra_clear_kernel *kernel, uintptr_t va, size_t nbytes, uint64_t qword);
+struct cra_clear_kernel *cr_amd64_fill_kernel_select(int random);
 unsigned char cr_amd64_inb(unsigned short port);
+uint16_t cr_amd64_inw(unsigned short port);
 int cr_amd64_init_gdt(struct cr_host_state *state);
 int cr_amd64_init_idt(struct cr_host_state *state);
 void cr_amd64_init_page_ent(struct cra_page_ent *pe, uintptr_t pfn_base, enum cra_pe_bits extra_bits, int pages_nx, int level, int map_direct);
-void cr_amd64_msleep(unsigned ns);
+int cr_amd64_mem_type_bits(const char *name, enum cra_pe_bits *pbits);
 void cr_amd64_outb(unsigned short port, unsigned char byte);
+void cr_amd64_outl(unsigned short port, uint32_t dword);
+void cr_amd64_outw(unsigned short port, uint16_t word);
+int cr_amd64_rdrand(uint64_t *pqword);
+uint64_t cr_amd64_rdtsc(void);
+void cr_amd64_reset(struct cra_reset *reset);
+int cr_amd64_reset_method(const char *name, enum cra_reset_method *pmethod);
+void cr_amd64_udelay(unsigned long us);
+uintptr_t cr_amd64_verify(enum cra_verify_kernel_id kernel, uintptr_t va, uintptr_t va_limit, size_t stride);
+enum cra_verify_kernel_id cr_amd64_verify_kernel_select(void);
 #endif /* !_AMD64DEF_H_ */
 
 /*
@@ -47,17 +47,227 @@ struct crc_cpu_regs {
 	"ORIG_RIP", "ORIG_CS", "ORIG_RFLAGS", "ORIG_SS",	\
 	"",
 
+/**
+ * SMP clearing modes
+ */
+enum crc_smp_mode {
+	CRC_SMP_NONE		= 0,
+	CRC_SMP_ALL		= 1,
+	CRC_SMP_CORES		= 2,
+};
+
+/**
+ * Overwrite patterns and maximum number of overwrite passes
+ */
+enum crc_pattern {
+	CRC_PATTERN_ZERO	= 0,
+	CRC_PATTERN_ONES	= 1,
+	CRC_PATTERN_ALT		= 2,
+	CRC_PATTERN_ALTINV	= 3,
+	CRC_PATTERN_RANDOM	= 4,
+};
+#define CRC_PATTERN_NAMES					\
+	"zero", "ones", "alt", "altinv", "random"
+#define CRC_PASSES_MAX		8
+
+/**
+ * Range of RAM VA skipped after repeated faults while zero-filling
+ */
+struct crc_skip {
+	uintptr_t	va_base, va_limit;
+};
+
+/**
+ * Fault counts after which to skip to the next 2M boundary, and coarse
+ * 2M skips after which to skip to the next 1G boundary, and the number
+ * of skipped ranges recorded per CPU
+ */
+#define CRC_FAULTS_2M_MAX	4
+#define CRC_SKIPS_2M_MAX	4
+#define CRC_SKIPS_MAX		64
+
+/**
+ * Number of nonzero lines found by the verification pass whose VA is
+ * recorded per CPU
+ */
+#define CRC_NONZERO_MAX		8
+
+/**
+ * Number of PCI functions whose bus mastering was disabled before
+ * clearing that are recorded, each as bus << 8 | devfn on segment 0
+ */
+#define CRC_PCI_FNS_MAX		64
+
+/**
+ * 16550 UART divisor latch value for 115200 baud, line status register
+ * polls per character before giving up on a missing or stuck UART, time
+ * in ms, or polls if the TSC frequency is unknown, to wait for another CPU
+ * to finish its line before dropping one's own, and interval in ms between
+ * progress lines
+ */
+#define CRC_SERIAL_DIVISOR	1
+#define CRC_SERIAL_POLLS_MAX	0x10000
+#define CRC_SERIAL_LOCK_MS	100
+#define CRC_SERIAL_LOCK_POLLS_MAX 0x1000000
+#define CRC_SERIAL_PROGRESS_MS	500
+
+/**
+ * Time budget in ms of dry runs, which bounds the time all CPUs spend stopped
+ * with interrupts disabled regardless of size, memory type, and passes
+ */
+#define CRC_DRY_RUN_MS_MAX	1000
+
+/**
+ * Maximum number of per-NUMA node progress bars above the VGA footer, their
+ * width in characters, and number of rows kept free above them for the
+ * outcome printed after the periods printed while clearing
+ */
+#define CRC_VGA_BARS_MAX	8
+#define CRC_VGA_BAR_WIDTH	48
+#define CRC_VGA_STATUS_ROWS	3
+
+/**
+ * Host CPU state saved by cr_clear_cpu_enter() and restored by
+ * cr_clear_cpu_leave(), along with the host VA of the per-CPU area
+ */
+struct crc_cpu_host {
+	uintptr_t	self;
+	uint64_t	cr3, rsp;
+	uint64_t	pat, fs_base, gs_base;
+	uint16_t	cs, ss, ds, es, fs, gs;
+	struct cra_gdtr_bits gdtr __attribute__((aligned(0x10)));
+	struct cra_idtr_bits idtr __attribute__((aligned(0x10)));
+};
+
+/**
+ * Per-CPU clearing state, located at the base of each per-CPU area in
+ * the map with the stack of the CPU above it; tsc_stopped is the TSC at
+ * which the CPU arrived once stopped, or 0, nbytes_cleared the number of
+ * bytes of chunks cleared, nbytes_zeroed the number of those bytes actually
+ * zero-filled, i.e. less those skipped, tsc_done the TSC at which the CPU
+ * finished, and
+ * nnmis the number of NMIs taken in the map, forwarded to the kernel once
+ * back from a dry run
+ */
+struct crc_cpu {
+	int		ncpu, nid;
+	int		clear;
+	volatile int	clear_flag;
+	struct cra_clear_kernel *clear_kernel;
+	uintptr_t	fault_va_2M, fault_va_1G;
+	size_t		nfaults_2M, nskips_2M;
+	struct crc_skip	skips[CRC_SKIPS_MAX];
+	size_t		nskips, nbytes_skipped;
+	uintptr_t	va_nonzero[CRC_NONZERO_MAX];
+	size_t		nnonzero;
+	volatile uint64_t
+			tsc_stopped;
+	volatile size_t	nbytes_cleared, nbytes_zeroed;
+	uint64_t	tsc_done;
+	size_t		nnmis;
+	struct crc_cpu_host host;
+};
+#define CRC_INIT_CPU(p, _ncpu, _nid, _clear) do {			\
+		(p)->ncpu = (_ncpu);					\
+		(p)->nid = (_nid);					\
+		(p)->clear = (_clear);					\
+		(p)->clear_flag = 0;					\
+		(p)->clear_kernel = NULL;				\
+		(p)->fault_va_2M = (p)->fault_va_1G = -1;		\
+		(p)->nfaults_2M = (p)->nskips_2M = 0;			\
+		(p)->nskips = (p)->nbytes_skipped = 0;			\
+		(p)->nnonzero = 0;					\
+		(p)->tsc_stopped = 0;					\
+		(p)->nbytes_cleared = (p)->nbytes_zeroed = 0;		\
+		(p)->tsc_done = 0;					\
+		(p)->nnmis = 0;						\
+	} while (0)
+
+/**
+ * Clear plan entry priority classes, cleared in descending order: bulk RAM,
+ * active anonymous LRU pages, slab pages holding e.g. keyring payloads and
+ * dm-crypt keys, and extents supplied by userland
+ */
+enum crc_priority {
+	CRC_PRIORITY_BULK	= 0,
+	CRC_PRIORITY_ANON	= 1,
+	CRC_PRIORITY_SLAB	= 2,
+	CRC_PRIORITY_USER	= 3,
+};
+
+/**
+ * Clear plan entry: range of RAM VA in map backed by a single contiguous
+ * PFN range local to a single NUMA node, the CRA_PS_{1G,2M,4K} alignment
+ * it was mapped at, its priority, and the range of chunks in the queue
+ * of its node it is split into
+ */
+struct crc_plan_ent {
+	uintptr_t	va;
+	size_t		nbytes;
+	uintptr_t	pfn;
+	int		nid;
+	unsigned	page_size;
+	int		priority;
+	size_t		nchunk_base, nchunks;
+};
+#define CRC_INIT_PLAN_ENT(p, _va, _nbytes, _pfn, _nid, _page_size, _priority) do {\
+		(p)->va = (_va);					\
+		(p)->nbytes = (_nbytes);				\
+		(p)->pfn = (_pfn);					\
+		(p)->nid = (_nid);					\
+		(p)->page_size = (_page_size);				\
+		(p)->priority = (_priority);				\
+		(p)->nchunk_base = 0;					\
+		(p)->nchunks = 0;					\
+	} while (0)
+
+/**
+ * Per-NUMA node queue of chunks of cr_host_state.clear_chunk_size bytes
+ * over the range of clear plan entries of the node, taken from with atomic
+ * fetch-and-add by CPUs local to the node and then by all other clearing
+ * CPUs, once for zero-filling and once for verifying, each on a separate
+ * cache line
+ */
+#define CRC_QUEUE_ALIGN		64
+struct crc_queue {
+	volatile size_t	nchunk_next;
+	volatile size_t	nchunk_verify_next;
+	volatile size_t	nchunks_done;
+	size_t		nchunks;
+	size_t		nent_base, nents;
+} __attribute__((aligned(CRC_QUEUE_ALIGN)));
+#define CRC_INIT_QUEUE(p) do {						\
+		(p)->nchunk_next = 0;					\
+		(p)->nchunk_verify_next = 0;				\
+		(p)->nchunks_done = 0;					\
+		(p)->nchunks = 0;					\
+		(p)->nent_base = 0;					\
+		(p)->nents = 0;						\
+	} while (0)
+
 /**
  * XXX
  */
-void cr_clear_clear(void);
+void cr_clear_clear(struct crc_cpu *cpu);
 int cr_clear_cpu_clear_exception(struct crc_cpu_regs *cpu_regs);
 int cr_clear_cpu_dump_regs(struct crc_cpu_regs *cpu_regs);
 void cr_clear_cpu_entry(void);
+void cr_clear_cpu_entry_ap(int ncpu);
+void cr_clear_cpu_enter(struct crc_cpu *cpu_host, struct crc_cpu *cpu, void (*fn)(struct crc_cpu *));
 int cr_clear_cpu_exception(struct crc_cpu_regs *cpu_regs);
-void cr_clear_cpu_setup(void (*fn)(void));
+void cr_clear_cpu_init(void);
+void __attribute__((noreturn)) cr_clear_cpu_leave(struct crc_cpu *cpu);
+struct crc_cpu *cr_clear_cpu_self(void);
+void cr_clear_cpu_setup(struct crc_cpu *cpu, void (*fn)(struct crc_cpu *));
+int cr_clear_passes_parse(const char *str, size_t len, enum crc_pattern *passes, size_t *pnpasses);
+void cr_clear_plan_init(struct crc_plan_ent *plan, size_t nplan);
+void cr_clear_serial_init(void);
+void cr_clear_serial_print_cstr(const char *str);
+void cr_clear_serial_print_hnum(uintptr_t u64);
 void cr_clear_vga_clear(void);
+void cr_clear_vga_print_bar(uintptr_t *pva_vga_cur, size_t n, size_t nmax, size_t width, unsigned char attr);
 void cr_clear_vga_print_cstr(uintptr_t *pva_vga_cur, const char *str, unsigned char attr, size_t align);
+void cr_clear_vga_print_dnum(uintptr_t *pva_vga_cur, uintptr_t u64, size_t ndigits, unsigned char attr, size_t align);
 void cr_clear_vga_print_hnum(uintptr_t *pva_vga_cur, uintptr_t u64, unsigned char attr, size_t align);
 void cr_clear_vga_print_reg(uintptr_t *pva_vga_cur, uintptr_t reg, unsigned char attr, size_t align);
 void cr_clear_vga_reset(void);
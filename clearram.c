@@ -29,11 +29,67 @@ module_exit(clearram_exit);
 MODULE_AUTHOR("Lucía Andrea Illanes Albornoz <lucia@luciaillanes.de>");
 MODULE_DESCRIPTION("clearram");
 MODULE_LICENSE("GPL");
-MODULE_SUPPORTED_DEVICE("clearram");
 
 struct cr_host_state cr_host_state = {
-	.host_cdev_fops = {.write = cr_host_cdev_write}
+	.clear_chunk_size = PAGE_SIZE * CRA_PS_1G,
+	.clear_smp_mode = CRC_SMP_NONE,
+	.host_cdev_fops = {
+		.owner = THIS_MODULE,
+		.mmap = cr_host_cdev_mmap,
+		.unlocked_ioctl = cr_host_cdev_ioctl,
+		.write = cr_host_cdev_write,
+	},
+	.clear_countdown = 3,
+	.host_prezero_mbps = 256,
 };
+module_param_named(smp, cr_host_state.clear_smp_mode, int, 0600);
+MODULE_PARM_DESC(smp, "SMP clearing mode: 0 boot CPU only (default), 1 all online CPUs, 2 one CPU per core");
+module_param_named(kernel, cr_host_state.host_clear_kernel_name, charp, 0400);
+MODULE_PARM_DESC(kernel, "zero-filling kernel: stosq, stosb, movnti, avx2, avx512, or clzero (default: best supported)");
+module_param_named(memtype, cr_host_state.host_mem_type_name, charp, 0400);
+MODULE_PARM_DESC(memtype, "memory type to map RAM with while clearing: uc, wc, wt, or wb (default)");
+module_param_named(passes, cr_host_state.host_passes, charp, 0400);
+MODULE_PARM_DESC(passes, "overwrite passes, comma-separated list of zero, ones, alt, altinv, or random (default: zero)");
+module_param_named(countdown, cr_host_state.clear_countdown, uint, 0400);
+MODULE_PARM_DESC(countdown, "seconds to count down for before resetting, at most 9 (default: 3)");
+module_param_named(reset, cr_host_state.host_reset_name, charp, 0400);
+MODULE_PARM_DESC(reset, "reset method: triple (triple fault, default), cf9 (reset control register), acpi (FADT reset register), or 8042 (keyboard controller), falling back to triple");
+module_param_named(verify, cr_host_state.clear_verify_stride, ulong, 0400);
+MODULE_PARM_DESC(verify, "verify RAM after clearing, one 64-byte line every <verify> bytes: 0 disabled (default), 64 full pass, 4096 one line per page");
+module_param_named(deadline_ms, cr_host_state.clear_deadline_ms, ulong, 0400);
+MODULE_PARM_DESC(deadline_ms, "time budget in ms for clearing RAM, highest priority first, before resetting regardless: 0 unbounded (default)");
+module_param_named(hints, cr_host_state.host_hints, int, 0400);
+MODULE_PARM_DESC(hints, "clear slab and active anonymous pages before bulk RAM, found in the background every 60 s (default: 0)");
+module_param_named(panic, cr_host_state.host_panic, int, 0400);
+MODULE_PARM_DESC(panic, "clear RAM when the kernel panics: 0 disabled (default), 1 on panic, 2 on panic and oops");
+module_param_array_named(trigger_keys, cr_host_state.host_trigger_keys, int, &cr_host_state.host_trigger_nkeys, 0400);
+MODULE_PARM_DESC(trigger_keys, "clear RAM when any of these input key codes is pressed, comma-separated (e.g. 116 for KEY_POWER)");
+module_param_array_named(trigger_sws, cr_host_state.host_trigger_sws, int, &cr_host_state.host_trigger_nsws, 0400);
+MODULE_PARM_DESC(trigger_sws, "clear RAM when any of these input switch codes is set, comma-separated (e.g. 0 for SW_LID)");
+module_param_named(trigger_usb, cr_host_state.host_trigger_usb, charp, 0400);
+MODULE_PARM_DESC(trigger_usb, "clear RAM when any of these USB devices is removed, comma-separated list of <vid>:<pid>[:<serial>], VID and PID in hex");
+module_param_named(trigger_acpi, cr_host_state.host_trigger_acpi, int, 0400);
+MODULE_PARM_DESC(trigger_acpi, "clear RAM when an ACPI power button device is pressed (default: 0)");
+module_param_named(flush_ms, cr_host_state.host_flush_ms, ulong, 0400);
+MODULE_PARM_DESC(flush_ms, "flush filesystems in parallel for at most <flush_ms> ms before clearing upon write(2): 0 disabled (default)");
+module_param_named(flush_fs, cr_host_state.host_flush_fs, charp, 0400);
+MODULE_PARM_DESC(flush_fs, "filesystem types to flush, comma-separated (default: " CRH_FLUSH_FS_DEFAULT ")");
+module_param_named(quiesce_pci, cr_host_state.host_quiesce_pci, int, 0600);
+MODULE_PARM_DESC(quiesce_pci, "disable bus mastering on all PCI functions before clearing to stop DMA (default: 0)");
+module_param_named(prezero_mb, cr_host_state.host_prezero_mb, ulong, 0400);
+MODULE_PARM_DESC(prezero_mb, "zero and hold up to <prezero_mb> MB of free RAM in the background, skipped at trigger time: 0 disabled (default)");
+module_param_named(prezero_mbps, cr_host_state.host_prezero_mbps, ulong, 0400);
+MODULE_PARM_DESC(prezero_mbps, "rate limit in MB/s of zeroing free RAM in the background (default: 256)");
+module_param_named(telemetry_addr, cr_host_state.clear_telemetry_addr, ulong, 0400);
+MODULE_PARM_DESC(telemetry_addr, "physical address of a reserved page to write a telemetry record to while clearing, read back through debugfs upon the next load: 0 disabled (default)");
+module_param_named(serial_port, cr_host_state.clear_serial_port, ushort, 0400);
+MODULE_PARM_DESC(serial_port, "I/O port base of a 16550 UART to write progress, throughput, and exception lines to while clearing at 115200 baud, e.g. 0x3f8: 0 disabled (default)");
+module_param_named(autotune, cr_host_state.host_autotune, int, 0400);
+MODULE_PARM_DESC(autotune, "benchmark and select zero-filling kernel, chunk size, and SMP mode at load time (default: 0)");
+module_param_named(autotune_mbps, cr_host_state.host_autotune_mbps, ulong, 0444);
+MODULE_PARM_DESC(autotune_mbps, "throughput in MB/s measured by autotune");
+module_param_named(autotune_eta_ms, cr_host_state.host_autotune_eta_ms, ulong, 0444);
+MODULE_PARM_DESC(autotune_eta_ms, "predicted time in ms to clear RAM measured by autotune");
 
 void clearram_exit(void) {
 	cr_host_lkm_exit();
@@ -74,6 +130,83 @@ int cr_host_evhand(struct module *m, int what, void *arg __unused)
 }
 #endif /* defined(__FreeBSD__) */
 
+/**
+ * crp_host_lkm_link_ram_page() - link RAM page and add or extend clear plan entry
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static int crp_host_lkm_link_ram_page(uintptr_t pfn, uintptr_t va) {
+	int err;
+	struct crc_plan_ent *ent;
+
+	if ((err = cr_host_map_link_ram_page(pfn, va)) < 0) {
+		return err;
+	} else
+	if (cr_host_state.clear_nplan > 0) {
+		ent = CRHS_PLAN_HOST(cr_host_state.clear_nplan - 1);
+		if (((ent->va + ent->nbytes) == va)
+		&&  ((ent->pfn + (ent->nbytes / PAGE_SIZE)) == pfn)
+		&&  (ent->nid == cr_host_state.host_plan_nid)
+		&&  (ent->page_size == cr_host_state.host_plan_page_size)) {
+			return ent->nbytes += PAGE_SIZE, 0;
+		}
+	}
+	if (cr_host_state.clear_nplan >= CRHS_PLAN_NENTS) {
+		return -ENOMEM;
+	} else {
+		ent = CRHS_PLAN_HOST(cr_host_state.clear_nplan++);
+		CRC_INIT_PLAN_ENT(ent, va, PAGE_SIZE, pfn,
+			cr_host_state.host_plan_nid,
+			cr_host_state.host_plan_page_size, CRC_PRIORITY_BULK);
+		return 0;
+	}
+}
+
+/**
+ * crp_host_lkm_plan_cmp() - order clear plan entries by NUMA node, descending priority, and VA
+ *
+ * Return: <0, 0, or >0 if ent1 is ordered before, equal to, or after ent2
+ */
+static int crp_host_lkm_plan_cmp(const void *ent1, const void *ent2) {
+	const struct crc_plan_ent *p1 = ent1, *p2 = ent2;
+
+	if (p1->nid != p2->nid) {
+		return (p1->nid < p2->nid) ? -1 : 1;
+	} else
+	if (p1->priority != p2->priority) {
+		return (p1->priority > p2->priority) ? -1 : 1;
+	} else
+	if (p1->va != p2->va) {
+		return (p1->va < p2->va) ? -1 : 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * crp_host_lkm_plan_split() - split clear plan entry at PFN
+ *
+ * Truncate the entry at pfn and append the remainder as a new entry of the
+ * same node, alignment, and priority.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static int crp_host_lkm_plan_split(struct crc_plan_ent *ent, uintptr_t pfn) {
+	struct crc_plan_ent *ent_new;
+	size_t nbytes;
+
+	if (cr_host_state.clear_nplan >= CRHS_PLAN_NENTS) {
+		return -ENOMEM;
+	} else {
+		nbytes = (pfn - ent->pfn) * PAGE_SIZE;
+		ent_new = CRHS_PLAN_HOST(cr_host_state.clear_nplan++);
+		CRC_INIT_PLAN_ENT(ent_new, ent->va + nbytes, ent->nbytes - nbytes,
+			pfn, ent->nid, ent->page_size, ent->priority);
+		ent->nbytes = nbytes;
+		return 0;
+	}
+}
+
 /**
  * cr_host_lkm_init() - kernel module entry point
  *
@@ -82,32 +215,118 @@ int cr_host_evhand(struct module *m, int what, void *arg __unused)
 
 int cr_host_lkm_init(void)
 {
-	int err, level;
-	uintptr_t pfn_block_base, pfn_block_limit, va_vga, va_page, va_pt;
+	int err, level, rsvd;
+	uintptr_t pfn_block_base, pfn_block_limit, va_vga, va_telemetry, va_page, va_pt;
+	uintptr_t pfn_node_base, pfn_node_limit, va_cpu, va_plan, va_skip;
 	struct crh_litem *litem;
 	struct crh_lrsvd_item *item;
-	size_t npage;
 	uintptr_t pt_idx, pfn;
 	struct cra_page_ent *pt;
+#if defined(DEBUG)
+	size_t nent;
+	struct crc_plan_ent *ent;
+#endif /* defined(DEBUG) */
 
 	/*
+	 * Select zero-filling kernel, verification kernel, and RAM memory type
 	 * Initialise image {base address,page count} range
 	 * Initialise PML4 self-mapping at 0xfffff80000000000
 	 * Initialise list of reserved pages
-	 * Walk and map physical RAM at cr_host_state.clear_va_top, in sizes and order of 1G, 2M, and 4K
-	 * Clone image pages at 4K page granularity
-	 * Append image pages to list of reserved pages
+	 * Allocate clear plan
+	 * Walk and map physical RAM at cr_host_state.clear_va_top, in sizes and order of 1G, 2M, and 4K,
+	 * split into ranges local to a single NUMA node, and add each contiguous range to the clear plan
+	 * Clone image pages at 4K page granularity, appending them to list of reserved pages
+	 * Allocate and clone per-CPU areas at CRHS_CPU_VA_BASE
+	 * Clone clear plan at CRHS_PLAN_VA_BASE
+	 * Allocate and clone skip bitmap of RAM pages at CRHS_SKIP_VA_BASE
 	 * Map VGA framebuffer pages into image at cr_host_state.clear_vga
-	 * Map and translate list of reserved pages at 0xfffff78000000000
+	 * Map reserved telemetry record page into image at cr_host_state.clear_telemetry, if requested
+	 * Map and translate list of reserved pages at 0xfffff78000000000, and mark them in the skip bitmap
 	 * Initialise GDT and IDT
-	 * Initialise character device node
+	 * Autotune zero-filling kernel, chunk size, and SMP mode, if requested
+	 * Report zero-filling throughput per RAM memory type in debug builds
+	 * Sort clear plan by NUMA node and priority and split it into chunk queues
+	 * Initialise character device node and heartbeat page
+	 * Resolve filesystem types to flush, if requested
+	 * Start prioritising slab and active anonymous pages in the background, if requested
+	 * Snapshot PCI functions to quiesce bus masters of, if requested
+	 * Read back telemetry record of previous clearing, if requested
+	 * Start pre-zeroing free RAM and register in-kernel triggers, if requested
 	 */
+	if (!(cr_host_state.clear_kernel = cr_amd64_clear_kernel_select(
+			cr_host_state.host_clear_kernel_name))) {
+		CRH_PRINTK_ERR("zero-filling kernel %s not supported",
+			cr_host_state.host_clear_kernel_name);
+		return -EINVAL;
+	} else {
+		CRH_PRINTK_INFO("using %s zero-filling kernel",
+			cr_host_state.clear_kernel->name);
+	}
+	if (!cr_host_state.host_passes) {
+		cr_host_state.host_passes = "zero";
+	}
+	if ((err = cr_clear_passes_parse(cr_host_state.host_passes,
+			strlen(cr_host_state.host_passes), cr_host_state.clear_passes,
+			&cr_host_state.clear_npasses)) < 0) {
+		CRH_PRINTK_ERR("invalid overwrite passes %s",
+			cr_host_state.host_passes);
+		return err;
+	} else {
+		cr_host_state.clear_fill_kernel = cr_amd64_fill_kernel_select(0);
+		cr_host_state.clear_fill_random_kernel = cr_amd64_fill_kernel_select(1);
+	}
+	if (cr_host_state.clear_verify_stride % CRA_VERIFY_LINE_SIZE) {
+		CRH_PRINTK_ERR("verification stride %zu not a multiple of %d",
+			cr_host_state.clear_verify_stride, CRA_VERIFY_LINE_SIZE);
+		return -EINVAL;
+	} else {
+		cr_host_state.clear_verify_kernel = cr_amd64_verify_kernel_select();
+	}
+	if (!cr_host_state.host_mem_type_name) {
+		cr_host_state.host_mem_type_name = "wb";
+	}
+	if ((err = cr_amd64_mem_type_bits(cr_host_state.host_mem_type_name,
+			&cr_host_state.host_mem_type_bits)) < 0) {
+		CRH_PRINTK_ERR("memory type %s not supported",
+			cr_host_state.host_mem_type_name);
+		return err;
+	}
+	if (cr_host_state.clear_countdown > 9) {
+		CRH_PRINTK_ERR("countdown of %u seconds exceeds 9 seconds",
+			cr_host_state.clear_countdown);
+		return -EINVAL;
+	}
+	if (!cr_host_state.host_reset_name) {
+		cr_host_state.host_reset_name = "triple";
+	}
+	if ((err = cr_amd64_reset_method(cr_host_state.host_reset_name,
+			&cr_host_state.clear_reset.method)) < 0) {
+		CRH_PRINTK_ERR("reset method %s not supported",
+			cr_host_state.host_reset_name);
+		return err;
+	}
 #if defined(__linux__)
 	cr_host_state.clear_image_base = (uintptr_t)THIS_MODULE->core_layout.base;
 	cr_host_state.clear_image_npages = THIS_MODULE->core_layout.size / PAGE_SIZE;
 	if (THIS_MODULE->core_layout.size % PAGE_SIZE) {
 		cr_host_state.clear_image_npages++;
 	}
+	cr_host_state.host_cpu_count = nr_cpu_ids;
+	cr_host_state.clear_tsc_khz = cr_host_tsc_khz();
+	if (cr_host_state.clear_deadline_ms) {
+		if (!boot_cpu_has(X86_FEATURE_CONSTANT_TSC)) {
+			CRH_PRINTK_ERR("time budget requires a constant rate TSC");
+			return -EINVAL;
+		} else {
+			CRH_PRINTK_INFO("clearing within %lu ms, TSC at %lu kHz",
+				cr_host_state.clear_deadline_ms, cr_host_state.clear_tsc_khz);
+		}
+	}
+	if ((cr_host_state.clear_reset.method == CRA_RESET_ACPI)
+	&&  ((err = cr_host_reset_acpi(&cr_host_state.clear_reset)) < 0)) {
+		CRH_PRINTK_ERR("no usable ACPI FADT reset register");
+		return err;
+	}
 #elif defined(__FreeBSD__)
 #error XXX
 #endif /* defined(__linux__) || defined(__FreeBSD__) */
@@ -116,31 +335,54 @@ int cr_host_lkm_init(void)
 		CRA_PE_READ_WRITE | CRA_PE_WRITE_THROUGH,
 		CRA_NX_ENABLE, CRA_LVL_PML4, 0);
 	cr_host_state.clear_va_top = 0;
+	cr_host_state.clear_nplan = 0;
 	va_vga = (uintptr_t)cr_host_state.clear_vga;
+	va_telemetry = (uintptr_t)cr_host_state.clear_telemetry;
+	va_cpu = CRHS_CPU_VA_BASE;
+	va_plan = CRHS_PLAN_VA_BASE;
+	va_skip = CRHS_SKIP_VA_BASE;
 	CRH_INIT_MALLOC_STATE(&cr_host_state.host_malloc_state, 0, 0);
 	CRH_INIT_PMAP_WALK_PARAMS(&cr_host_state.host_pmap_walk_params);
 	CRH_LIST_INIT(&cr_host_state.host_lrsvd, sizeof(struct crh_lrsvd_item));
+	if (!(cr_host_state.host_plan_va_base = (uintptr_t)cr_host_vmalloc(
+			CRHS_PLAN_PAGES, PAGE_SIZE))) {
+		err = -ENOMEM;
+		goto fail;
+	}
 	for (level = CRA_LVL_PDP; level >= CRA_LVL_PT; level--) {
+		switch (level) {
+		case CRA_LVL_PDP: cr_host_state.host_plan_page_size = CRA_PS_1G; break;
+		case CRA_LVL_PD: cr_host_state.host_plan_page_size = CRA_PS_2M; break;
+		case CRA_LVL_PT: cr_host_state.host_plan_page_size = CRA_PS_4K; break;
+		}
 		CRH_INIT_PMAP_WALK_PARAMS(&cr_host_state.host_pmap_walk_params);
 		while ((err = cr_host_pmap_walk(
 				&cr_host_state.host_pmap_walk_params,
 				&pfn_block_base, &pfn_block_limit, NULL)) == 1) {
-			if ((err = cr_amd64_map_pages_unaligned(
-					cr_host_state.clear_pml4,
-					&cr_host_state.clear_va_top,
-					pfn_block_base, pfn_block_limit,
-					CRA_PE_READ_WRITE | CRA_PE_CACHE_DISABLE, CRA_NX_ENABLE,
-					CRA_PS_4K, level,
-					cr_host_map_alloc_pt,
-					cr_host_map_link_ram_page,
-					cr_host_map_xlate_pfn)) < 0) {
-				goto fail;
+			for (pfn_node_base = pfn_block_base;
+					pfn_node_base < pfn_block_limit;
+					pfn_node_base = pfn_node_limit) {
+				cr_host_state.host_plan_nid = cr_host_pmap_node(
+					pfn_node_base, pfn_block_limit, &pfn_node_limit);
+				if ((err = cr_amd64_map_pages_unaligned(
+						cr_host_state.clear_pml4,
+						&cr_host_state.clear_va_top,
+						pfn_node_base, pfn_node_limit,
+						CRA_PE_READ_WRITE | cr_host_state.host_mem_type_bits,
+						CRA_NX_ENABLE, CRA_PS_4K, level,
+						cr_host_map_alloc_pt,
+						crp_host_lkm_link_ram_page,
+						cr_host_map_xlate_pfn)) < 0) {
+					goto fail;
+				}
 			}
 		}
 		if (err < 0) {
 			goto fail;
 		}
 	}
+	cr_host_state.host_skip_npages = (((((cr_host_state.clear_va_top / PAGE_SIZE) + 63) / 64)
+		* sizeof(uint64_t)) + (PAGE_SIZE - 1)) / PAGE_SIZE;
 	if ((err = cr_amd64_map_pages_clone4K(cr_host_state.clear_pml4,
 			cr_host_state.clear_image_base, NULL,
 			CRA_PE_READ_WRITE | CRA_PE_WRITE_THROUGH, CRA_NX_DISABLE,
@@ -150,6 +392,43 @@ int cr_host_lkm_init(void)
 			cr_host_map_xlate_pfn)) < 0) {
 		goto fail;
 	} else
+	if (!(cr_host_state.host_cpu_va_base = (uintptr_t)cr_host_vmalloc(
+			cr_host_state.host_cpu_count, CRHS_CPU_SIZE))) {
+		err = -ENOMEM;
+		goto fail;
+	} else
+	if ((err = cr_amd64_map_pages_clone4K(cr_host_state.clear_pml4,
+			cr_host_state.host_cpu_va_base, &va_cpu,
+			CRA_PE_READ_WRITE | CRA_PE_WRITE_THROUGH, CRA_NX_ENABLE,
+			cr_host_state.host_cpu_count * CRHS_CPU_PAGES,
+			cr_host_map_alloc_pt,
+			cr_host_map_link_rsvd_page,
+			cr_host_map_xlate_pfn)) < 0) {
+		goto fail;
+	} else
+	if ((err = cr_amd64_map_pages_clone4K(cr_host_state.clear_pml4,
+			cr_host_state.host_plan_va_base, &va_plan,
+			CRA_PE_READ_WRITE | CRA_PE_WRITE_THROUGH, CRA_NX_ENABLE,
+			CRHS_PLAN_PAGES,
+			cr_host_map_alloc_pt,
+			cr_host_map_link_rsvd_page,
+			cr_host_map_xlate_pfn)) < 0) {
+		goto fail;
+	} else
+	if (!(cr_host_state.host_skip_va_base = (uintptr_t)cr_host_vmalloc(
+			cr_host_state.host_skip_npages, PAGE_SIZE))) {
+		err = -ENOMEM;
+		goto fail;
+	} else
+	if ((err = cr_amd64_map_pages_clone4K(cr_host_state.clear_pml4,
+			cr_host_state.host_skip_va_base, &va_skip,
+			CRA_PE_READ_WRITE | CRA_PE_WRITE_THROUGH, CRA_NX_ENABLE,
+			cr_host_state.host_skip_npages,
+			cr_host_map_alloc_pt,
+			cr_host_map_link_rsvd_page,
+			cr_host_map_xlate_pfn)) < 0) {
+		goto fail;
+	} else
 	if ((err = cr_amd64_map_pages_unaligned(
 			cr_host_state.clear_pml4,
 			&va_vga,
@@ -161,6 +440,33 @@ int cr_host_lkm_init(void)
 			cr_host_map_xlate_pfn)) < 0) {
 		goto fail;
 	}
+	if (cr_host_state.clear_telemetry_addr) {
+		pfn = cr_host_state.clear_telemetry_addr / PAGE_SIZE;
+		rsvd = 1;
+#if defined(__linux__)
+		rsvd = (region_intersects(cr_host_state.clear_telemetry_addr, PAGE_SIZE,
+			IORESOURCE_MEM, IORES_DESC_RESERVED) == REGION_INTERSECTS);
+#endif /* defined(__linux__) */
+		if ((cr_host_state.clear_telemetry_addr % PAGE_SIZE)
+		||  (cr_host_map_xlate_pfn(CRH_PTL_RAM_PAGE, pfn, &va_page) == 0)
+		||  !rsvd) {
+			CRH_PRINTK_ERR("telemetry address 0x%lx not page-aligned or not reserved",
+				cr_host_state.clear_telemetry_addr);
+			err = -EINVAL;
+			goto fail;
+		} else
+		if ((err = cr_amd64_map_pages_unaligned(
+				cr_host_state.clear_pml4,
+				&va_telemetry,
+				pfn, pfn + CRHS_TELEMETRY_PAGES,
+				CRA_PE_READ_WRITE | CRA_PE_CACHE_DISABLE, CRA_NX_ENABLE,
+				CRA_PS_4K, CRA_LVL_PT,
+				cr_host_map_alloc_pt,
+				cr_host_map_link_ram_page,
+				cr_host_map_xlate_pfn)) < 0) {
+			goto fail;
+		}
+	}
 	for (litem = cr_host_state.host_lrsvd.head; litem; litem = litem->next) {
 		item = (struct crh_lrsvd_item *)&litem->item;
 		if ((err = cr_host_map_xlate_pfn(CRH_PTL_RAM_PAGE,
@@ -179,39 +485,71 @@ int cr_host_lkm_init(void)
 				}
 			} else {
 				pt[pt_idx].bits &= ~CRA_PE_PRESENT;
+				*CRHS_SKIP_HOST(va_page) |= CRHS_SKIP_BIT(va_page);
 			}
 		}
 	}
-	for (npage = 0; npage < cr_host_state.clear_image_npages; npage++) {
-		pfn = cr_host_virt_to_phys(cr_host_state.clear_image_base + (npage * PAGE_SIZE));
-		if ((err = cr_host_map_xlate_pfn(CRH_PTL_RAM_PAGE, pfn, &va_page)) < 0) {
-			goto fail;
-		}
-		for (level = CRA_LVL_PML4, pt = cr_host_state.clear_pml4;
-				level >= CRA_LVL_PT; level--) {
-			pt_idx = CRA_VA_TO_PE_IDX(va_page, level);
-			if (level > CRA_LVL_PT) {
-				if ((err = cr_host_map_xlate_pfn(CRH_PTL_PAGE_TABLE,
-						pt[pt_idx].pfn_base, &va_pt)) < 0) {
-					goto fail;
-				} else {
-					pt = (struct cra_page_ent *)va_pt;
-				}
-			} else {
-				pt[pt_idx].bits &= ~CRA_PE_PRESENT;
-			}
-		}
-
-	}
 	if ((err = cr_amd64_init_gdt(&cr_host_state)) < 0) {
 		goto fail;
 	} else
 	if ((err = cr_amd64_init_idt(&cr_host_state)) < 0) {
 		goto fail;
 	}
+#if defined(__linux__)
+	if (cr_host_state.host_autotune
+	&&  ((err = cr_host_autotune()) < 0)) {
+		goto fail;
+	}
+# if defined(DEBUG)
+	if ((err = cr_host_autotune_mem_types()) < 0) {
+		goto fail;
+	}
+# endif /* defined(DEBUG) */
+#endif /* defined(__linux__) */
+	cr_host_lkm_plan_sort();
+#if defined(DEBUG)
+	for (nent = 0; nent < cr_host_state.clear_nplan; nent++) {
+		ent = CRHS_PLAN_HOST(nent);
+		CRH_PRINTK_DEBUG("clear plan entry 0x%016lx..0x%016lx (PFN 0x%013lx) on node %d, page size %u, priority %d, %zu chunks",
+			ent->va, ent->va + ent->nbytes, ent->pfn, ent->nid,
+			ent->page_size, ent->priority, ent->nchunks);
+	}
+#endif /* defined(DEBUG) */
 	if ((err = cr_host_cdev_init(&cr_host_state)) < 0) {
 		goto fail;
 	}
+#if defined(__linux__)
+	if ((err = cr_host_heartbeat_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	} else
+	if ((err = cr_host_flush_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	} else
+	if ((err = cr_host_hints_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	} else
+	if ((err = cr_host_pci_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	} else
+	if ((err = cr_host_telemetry_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	}
+#endif /* defined(__linux__) */
+#if defined(__linux__)
+	if ((err = cr_host_prezero_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	} else
+	if ((err = cr_host_trigger_init()) < 0) {
+		cr_host_lkm_exit();
+		goto out;
+	}
+#endif /* defined(__linux__) */
 out:	if (err < 0) {
 		CRH_PRINTK_ERR("finished, err=%d", err);
 	} else {
@@ -219,9 +557,75 @@ out:	if (err < 0) {
 	}
 	return err;
 fail:	cr_host_map_free(cr_host_state.clear_pml4, cr_host_vmfree);
+	if (cr_host_state.host_cpu_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_cpu_va_base);
+	}
+	if (cr_host_state.host_plan_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_plan_va_base);
+	}
+	if (cr_host_state.host_skip_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_skip_va_base);
+	}
 	goto out;
 }
 
+/**
+ * cr_host_lkm_plan_prioritise() - raise priority of PFN range in clear plan
+ * @pfn_base:	first PFN of range
+ * @npages:	number of pages in range
+ * @priority:	CRC_PRIORITY_* class to raise range to
+ *
+ * Split all clear plan entries overlapping the range whose priority is
+ * lower than priority and raise the priority of the overlapping parts. The
+ * clear plan must be sorted with cr_host_lkm_plan_sort() afterwards.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+
+int cr_host_lkm_plan_prioritise(uintptr_t pfn_base, size_t npages, int priority)
+{
+	int err;
+	struct crc_plan_ent *ent;
+	size_t nent, nplan;
+	uintptr_t pfn_limit, ent_pfn_limit;
+
+	pfn_limit = pfn_base + npages;
+	for (nent = 0, nplan = cr_host_state.clear_nplan; nent < nplan; nent++) {
+		ent = CRHS_PLAN_HOST(nent);
+		ent_pfn_limit = ent->pfn + (ent->nbytes / PAGE_SIZE);
+		if ((ent->priority >= priority)
+		||  (ent_pfn_limit <= pfn_base) || (ent->pfn >= pfn_limit)) {
+			continue;
+		} else
+		if ((pfn_limit < ent_pfn_limit)
+		&&  ((err = crp_host_lkm_plan_split(ent, pfn_limit)) < 0)) {
+			return err;
+		} else
+		if (pfn_base > ent->pfn) {
+			if ((err = crp_host_lkm_plan_split(ent, pfn_base)) < 0) {
+				return err;
+			} else {
+				ent = CRHS_PLAN_HOST(cr_host_state.clear_nplan - 1);
+			}
+		}
+		ent->priority = priority;
+	}
+	return 0;
+}
+
+/**
+ * cr_host_lkm_plan_sort() - sort clear plan and split it into chunk queues
+ *
+ * Return: Nothing
+ */
+
+void cr_host_lkm_plan_sort(void)
+{
+	sort(CRHS_PLAN_HOST(0), cr_host_state.clear_nplan,
+		sizeof(struct crc_plan_ent), crp_host_lkm_plan_cmp, NULL);
+	cr_clear_plan_init(CRHS_PLAN_HOST(0), cr_host_state.clear_nplan);
+}
+
 /*
  * vim:fileencoding=utf-8 foldmethod=marker noexpandtab sw=8 ts=8 tw=120
  */
@@ -21,15 +21,48 @@
 #define _CLEARRAM_H_
 
 #if defined(__linux__)
+#include <asm/apic.h>
+#include <asm/fpu/api.h>
+#include <asm/nmi.h>
+#include <asm/tsc.h>
+#include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/cgroup.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
+#include <linux/kdebug.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/magic.h>
 #include <linux/mm.h>
+#include <linux/vmstat.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/panic_notifier.h>
+#include <linux/pci.h>
 #include <linux/resource.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/shrinker.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
 #include <linux/sort.h>
+#include <linux/stop_machine.h>
+#include <linux/topology.h>
+#include <linux/uaccess.h>
+#include <linux/usb.h>
+#include <linux/version.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <stdarg.h>
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)) || (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+#error Only Linux v5.16 through v6.6 are supported at present.
+#endif
 #elif defined(__FreeBSD__)
 #include <sys/types.h>
 #include <sys/module.h>
@@ -51,22 +84,32 @@ struct cr_host_state;
 #include "amd64def.h"
 #include "hostdef.h"
 #include "cleardef.h"
+#include "ioctldef.h"
 
 /**
  * LKM state
  */
+#define CRHS_CPU_PAGES		8
+#define CRHS_CPU_SIZE		(CRHS_CPU_PAGES * PAGE_SIZE)
+#define CRHS_CPU_VA_BASE	0xfffff70000000000ULL
 #define CRHS_GDT_PAGES		1
 #define CRHS_IDT_PAGES		1
-#define CRHS_STACK_PAGES	4
+#define CRHS_NODES_MAX		64
+#define CRHS_PLAN_PAGES		256
+#define CRHS_PLAN_SIZE		(CRHS_PLAN_PAGES * PAGE_SIZE)
+#define CRHS_PLAN_NENTS		(CRHS_PLAN_SIZE / sizeof(struct crc_plan_ent))
+#define CRHS_PLAN_VA_BASE	0xfffff60000000000ULL
+#define CRHS_SKIP_VA_BASE	0xfffff50000000000ULL
+#define CRHS_TELEMETRY_PAGES	1
 #define CRHS_VGA_PFN_BASE	0xb8
 #define CRHS_VGA_PAGES		8
 struct cr_host_state {
-	/* [GI]DT, PML4, stack, and VGA framebuffer VA layout page(s) */
+	/* [GI]DT, PML4, VGA framebuffer, and telemetry record VA layout page(s) */
 	struct cra_gdt_ent	clear_gdt[CRHS_GDT_PAGES * (PAGE_SIZE / sizeof(struct cra_gdt_ent))] __attribute__((aligned(PAGE_SIZE)));
 	struct cra_idt_ent	clear_idt[CRHS_IDT_PAGES * (PAGE_SIZE / sizeof(struct cra_idt_ent))] __attribute__((aligned(PAGE_SIZE)));
 	struct cra_page_ent	clear_pml4[512] __attribute__((aligned(PAGE_SIZE)));
-	uintptr_t		clear_stack[CRHS_STACK_PAGES * (PAGE_SIZE / sizeof(uintptr_t))] __attribute__((aligned(PAGE_SIZE)));
 	unsigned char		clear_vga[CRHS_VGA_PAGES * (PAGE_SIZE / sizeof(unsigned char))] __attribute__((aligned(PAGE_SIZE)));
+	unsigned char		clear_telemetry[CRHS_TELEMETRY_PAGES * (PAGE_SIZE / sizeof(unsigned char))] __attribute__((aligned(PAGE_SIZE)));
 
 	/* CR3, [GI]DTR registers, and exception wrappers base VA */
 	struct cra_cr3		clear_cr3 __attribute__((aligned(0x8)));
@@ -79,9 +122,80 @@ struct cr_host_state {
 	size_t			clear_image_npages;
 	uintptr_t		clear_va_top;
 
-	/* XXX */
-	volatile int		clear_clear_flag;
+	/* Zero-filling kernel and size of chunks zero-filled per call */
+	struct cra_clear_kernel *clear_kernel;
+	size_t			clear_chunk_size;
+
+	/* Pattern-filling kernels and overwrite passes */
+	struct cra_clear_kernel *clear_fill_kernel;
+	struct cra_clear_kernel *clear_fill_random_kernel;
+	enum crc_pattern	clear_passes[CRC_PASSES_MAX];
+	size_t			clear_npasses;
+
+	/* Secret mixed into random patterns, drawn at the start of clearing */
+	uint64_t		clear_pattern_seed;
+
+	/* Clear plan entry count and chunk queues by NUMA node */
+	size_t			clear_nplan;
+	struct crc_queue	clear_queues[CRHS_NODES_MAX];
+
+	/*
+	 * Flag set while a dry run clears its own plan entries beyond the
+	 * clear plan, and the chunk queues and bytes to clear it replaced
+	 */
+	int			clear_dry_run;
+	struct crc_queue	clear_dry_run_queues[CRHS_NODES_MAX];
+	size_t			clear_dry_run_nbytes_total;
+
+	/* Verification kernel and stride, or 0 if verification is disabled */
+	enum cra_verify_kernel_id clear_verify_kernel;
+	size_t			clear_verify_stride;
+
+	/* TSC frequency, time budget and TSC deadline, or 0 if unbounded */
+	unsigned long		clear_tsc_khz;
+	unsigned long		clear_deadline_ms;
+	uint64_t		clear_tsc_deadline;
+
+	/* Flag set if storage was flushed and bytes of dirty file pages left */
+	int			clear_flushed;
+	size_t			clear_flush_nbytes_dirty;
+
+	/* Flag set if PCI bus masters were quiesced, their count and functions */
+	int			clear_pci_quiesced;
+	size_t			clear_npci_fns;
+	uint32_t		clear_pci_fns[CRC_PCI_FNS_MAX];
+
+	/* TSC at trigger time, when stopping CPUs, and at the start of clearing */
+	uint64_t		clear_tsc_trigger;
+	uint64_t		clear_tsc_stop;
+	uint64_t		clear_tsc_start;
+
+	/* Physical address of reserved telemetry record page, or 0 if disabled */
+	unsigned long		clear_telemetry_addr;
+
+	/* 16550 UART I/O port base, or 0 if disabled, line lock, and TSC of next progress line */
+	unsigned short		clear_serial_port;
+	volatile int		clear_serial_lock;
+	uint64_t		clear_serial_tsc_next;
+
+	/* Countdown in seconds before resetting and reset method */
+	unsigned		clear_countdown;
+	struct cra_reset	clear_reset;
+
+	/* SMP mode, boot CPU, clearing CPU count, and CPU barriers */
+	int			clear_smp_mode;
+	int			clear_cpu_boot;
+	size_t			clear_ncpus;
+	volatile int		clear_cpus_go;
+	volatile int		clear_cpus_clearing;
+	volatile int		clear_cpus_running;
+
+	/* VGA framebuffer cursor, and limit of the periods printed while clearing */
 	uintptr_t		clear_va_vga_cur;
+	uintptr_t		clear_va_vga_limit;
+
+	/* Bytes of RAM to clear, summed with the chunk queues, for the ETA in the VGA footer */
+	size_t			clear_nbytes_total;
 
 #if defined(__linux__)
 	/* Character device node class, device pointer, and major number */
@@ -106,12 +220,123 @@ struct cr_host_state {
 	/* crh_host_m{alloc,free}() state */
 	struct crh_malloc_state	host_malloc_state;
 
+	/* Name of zero-filling kernel to select, if any */
+	char *			host_clear_kernel_name;
+	char *			host_mem_type_name;
+	char *			host_passes;
+	char *			host_reset_name;
+	enum cra_pe_bits	host_mem_type_bits;
+
+	/* Flag to prioritise pages in kernel-derived classes in the background */
+	int			host_hints;
+
+	/* Flag set by the first trigger, ignoring all others */
+	volatile int		host_triggered;
+
+#if defined(__linux__)
+	/*
+	 * Panic (1) or panic and oops (2) trigger mode, key and switch codes,
+	 * USB devices removed, and ACPI power button flag triggering clearing
+	 * in kernel context, and state
+	 */
+	int			host_panic;
+	int			host_trigger_keys[CRH_TRIGGER_CODES_MAX];
+	unsigned		host_trigger_nkeys;
+	int			host_trigger_sws[CRH_TRIGGER_CODES_MAX];
+	unsigned		host_trigger_nsws;
+	char *			host_trigger_usb;
+	int			host_trigger_acpi;
+	struct crh_trigger_state
+				host_trigger_state;
+
+	/* Storage flush time limit in ms, filesystem types, and state */
+	unsigned long		host_flush_ms;
+	char *			host_flush_fs;
+	struct crh_flush_state	host_flush;
+
+	/* Flag set to quiesce PCI bus masters before clearing and PCI functions */
+	int			host_quiesce_pci;
+	struct crh_pci_state	host_pci;
+
+	/* CPUs stopped by cr_host_cpu_stop_all() */
+	struct cpumask		host_cpu_stop_mask;
+
+	/* Background slab and active anonymous page hints state */
+	struct crh_hints_state	host_hints_state;
+
+	/* Dead-man switch heartbeat state */
+	struct crh_heartbeat_state
+				host_heartbeat;
+
+	/* Telemetry record of the previous clearing read back at load time */
+	struct crh_telemetry_state
+				host_telemetry;
+#endif /* defined(__linux__) */
+
+#if defined(__linux__)
+	/* Pre-zeroed free RAM limit in MB, rate limit in MB/s, and state */
+	unsigned long		host_prezero_mb;
+	unsigned long		host_prezero_mbps;
+	struct crh_prezero_state
+				host_prezero;
+#endif /* defined(__linux__) */
+
+	/* Autotuning flag, measured throughput, and predicted clearing time */
+	int			host_autotune;
+	unsigned long		host_autotune_mbps;
+	unsigned long		host_autotune_eta_ms;
+
+	/* Per-CPU areas base VA in host and number of per-CPU areas */
+	uintptr_t		host_cpu_va_base;
+	size_t			host_cpu_count;
+
+	/* Skip bitmap of reserved RAM pages in map and its page count */
+	uintptr_t		host_skip_va_base;
+	size_t			host_skip_npages;
+
+	/* Clear plan array, NUMA node and alignment of RAM being mapped */
+	uintptr_t		host_plan_va_base;
+	int			host_plan_nid;
+	unsigned		host_plan_page_size;
+
 	/* XXX */
 	struct crh_list		host_lrsvd;
 	struct crh_pages_tree_node
 				host_pages_tree;
 };
 extern struct cr_host_state	cr_host_state;
+
+/**
+ * CRHS_CPU_{HOST,MAP}() - get per-CPU area of CPU in host or in map
+ */
+#define CRHS_CPU_HOST(ncpu)						\
+	((struct crc_cpu *)(cr_host_state.host_cpu_va_base + ((ncpu) * CRHS_CPU_SIZE)))
+#define CRHS_CPU_MAP(ncpu)						\
+	((struct crc_cpu *)(CRHS_CPU_VA_BASE + ((ncpu) * CRHS_CPU_SIZE)))
+
+/**
+ * CRHS_PLAN_{HOST,MAP}() - get clear plan entry in host or in map
+ */
+#define CRHS_PLAN_HOST(nent)						\
+	(&((struct crc_plan_ent *)cr_host_state.host_plan_va_base)[(nent)])
+#define CRHS_PLAN_MAP(nent)						\
+	(&((struct crc_plan_ent *)CRHS_PLAN_VA_BASE)[(nent)])
+
+/**
+ * CRHS_TELEMETRY() - get telemetry record in map
+ */
+#define CRHS_TELEMETRY()						\
+	((struct cr_telemetry *)cr_host_state.clear_telemetry)
+
+/**
+ * CRHS_SKIP_{HOST,MAP}() - get skip bitmap qword of RAM VA in host or in map
+ */
+#define CRHS_SKIP_HOST(va)						\
+	(&((uint64_t *)cr_host_state.host_skip_va_base)[((va) / PAGE_SIZE) / 64])
+#define CRHS_SKIP_MAP(va)						\
+	(&((uint64_t *)CRHS_SKIP_VA_BASE)[((va) / PAGE_SIZE) / 64])
+#define CRHS_SKIP_BIT(va)						\
+	(1ULL << (((va) / PAGE_SIZE) % 64))
 #endif /* !_CLEARRAM_H_ */
 
 /*
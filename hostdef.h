@@ -119,15 +119,223 @@ struct crh_pmap_walk_params {
 		(p)->restart = 1;					\
 	} while (0)
 
-#if defined(__linux__) && defined(CONFIG_SMP)
+#if defined(__linux__)
+/**
+ * cr_host_cdev_write() maximum number of bytes of data written examined
+ */
+#define CRH_CDEV_WRITE_MAX		128
+
+/**
+ * CR_IOC_PRIORITISE maximum size of virtual extents and number of pages
+ * translated per batch between rescheduling points
+ */
+#define CRH_PRIORITISE_VIRT_MAX_MB	4096
+#define CRH_PRIORITISE_BATCH_PAGES	64
+
+/**
+ * CR_IOC_CLEAR maximum number of extents per call and number of pages
+ * zero-filled per batch between rescheduling points
+ */
+#define CRH_CLEAR_EXTENTS_MAX		256
+#define CRH_CLEAR_BATCH_PAGES		512
+
+/**
+ * CR_IOC_SCRUB pages zero-filled per batch, resident size from which an
+ * address space is zero-filled in parallel, maximum number of batches in
+ * flight, and state
+ */
+#define CRH_SCRUB_BATCH_PAGES		512
+#define CRH_SCRUB_PARALLEL_MB		64
+#define CRH_SCRUB_WORKS_MAX		16
+struct crh_scrub_work {
+	struct work_struct	work;
+	struct page *		pages[CRH_SCRUB_BATCH_PAGES];
+	size_t			npages;
+};
+struct crh_scrub_state {
+	struct crh_scrub_work *	works;
+	size_t			nworks, nwork;
+	size_t			nbytes, nbytes_skipped;
+};
+
 /**
- * cr_host_stop_cpu() parameters
+ * CR_IOC_DRY_RUN maximum size in GB, which bounds the RAM allocated, the
+ * time spent stopped being bounded by CRC_DRY_RUN_MS_MAX, and order of
+ * blocks allocated
  */
-struct crh_stop_cpu_params {
+#define CRH_DRY_RUN_GB_MAX		16
+#define CRH_DRY_RUN_ORDER		9
+
+/**
+ * cr_host_tsc_khz() calibration interval if the kernel has not calibrated the TSC
+ */
+#define CRH_TSC_CALIBRATE_MS		10
+
+/**
+ * cr_host_hints_*() classification interval and state: runs of 2 MB regions
+ * found holding slab or active anonymous pages, at most as many as the clear
+ * plan holds entries, their count, and periodic work item
+ */
+#define CRH_HINTS_INTERVAL_MS		60000
+struct crh_hints_run {
+	uintptr_t		pfn;
+	size_t			npages;
+	int			priority;
+};
+struct crh_hints_state {
+	struct crh_hints_run *	runs;
+	size_t			nruns;
+	struct delayed_work	work;
+	int			work_queued;
+};
+
+/**
+ * cr_host_prezero_*() block order, idle interval, and back-off interval after
+ * being shrunk, and state
+ */
+#define CRH_PREZERO_ORDER		9
+#define CRH_PREZERO_IDLE_MS		1000
+#define CRH_PREZERO_BACKOFF_MS		10000
+struct crh_prezero_state {
+	struct task_struct *	thread;
+	struct shrinker		shrinker;
+	int			shrinker_registered;
 	spinlock_t		lock;
-	int			ncpus_stopped;
+	struct list_head	blocks;
+	size_t			nblocks;
+	unsigned long		jiffies_shrunk;
+};
+
+/**
+ * cr_host_trigger_*() in-kernel trigger state: panic, die, and USB notifier
+ * blocks, input handler, registration flags, ACPI power button handles
+ * notify handlers were installed on, USB devices matched on removal, flag
+ * set once triggered in kernel context, and NMI stop state of
+ * cr_host_cpu_stop_all(), i.e. whether CPUs are being stopped, the number
+ * of CPUs that joined clearing or'd with CRH_NMI_STOP_OPEN while CPUs may
+ * still join, and the CPUs sent an NMI; CPUs that have not joined after
+ * CRH_NMI_STOP_TIMEOUT_US are left out of clearing
+ */
+#define CRH_NMI_STOP_OPEN		0x80000000U
+#define CRH_NMI_STOP_TIMEOUT_US		10000
+#define CRH_TRIGGER_ACPI_HID		"PNP0C0C"
+#define CRH_TRIGGER_ACPI_MAX		4
+#define CRH_TRIGGER_ACPI_NOTIFY		0x80
+#define CRH_TRIGGER_CODES_MAX		8
+#define CRH_TRIGGER_USB_MAX		8
+struct crh_trigger_usb {
+	u16			vid, pid;
+	char			serial[64];
+};
+struct crh_trigger_state {
+	struct notifier_block	panic_nb;
+	struct notifier_block	die_nb;
+	struct notifier_block	usb_nb;
+	struct input_handler	input_handler;
+	int			panic_registered;
+	int			die_registered;
+	int			usb_registered;
+	int			input_registered;
+	int			nmi_registered;
+	acpi_handle		acpi_handles[CRH_TRIGGER_ACPI_MAX];
+	size_t			nacpi_handles;
+	struct crh_trigger_usb	usb[CRH_TRIGGER_USB_MAX];
+	size_t			nusb;
+	int			triggered;
+	volatile int		nmi_stop;
+	volatile unsigned	nmi_njoined;
+	struct cpumask		nmi_mask;
 };
-#endif /* defined(__linux__) && defined(CONFIG_SMP) */
+
+/**
+ * cr_host_flush() filesystem types to flush, per-superblock work item, and
+ * state: filesystem types resolved at loading time, number of superblocks
+ * still being flushed, and completion signalled once all have been
+ */
+#define CRH_FLUSH_FS_DEFAULT		"ext4,xfs,btrfs,f2fs,vfat,exfat"
+#define CRH_FLUSH_FS_MAX		16
+struct crh_flush_work {
+	struct work_struct	work;
+	struct super_block *	sb;
+};
+struct crh_flush_state {
+	struct file_system_type *
+				fs_types[CRH_FLUSH_FS_MAX];
+	size_t			nfs_types;
+	atomic_t		npending;
+	struct completion	done;
+};
+
+/**
+ * cr_host_heartbeat_*() minimum timeout, number of samples per timeout, and
+ * state: heartbeat page, sampling hrtimer and its period, timeout, last
+ * counter value sampled and time it was first sampled at, and mutex
+ * serialising arming and disarming
+ */
+#define CRH_HEARTBEAT_TIMEOUT_MIN_MS	10
+#define CRH_HEARTBEAT_NCHECKS		4
+struct crh_heartbeat_state {
+	struct page *		page;
+	struct hrtimer		timer;
+	ktime_t			period;
+	ktime_t			timeout;
+	uint64_t		counter_last;
+	ktime_t			ktime_last;
+	struct mutex		mutex;
+};
+
+/**
+ * cr_host_pci_{exit,init,quiesce}() functions snapshotted and state: PCI
+ * functions on segment 0 as bus and devfn, appended to in process context
+ * only and published through their count, functions on other segments left
+ * out, bus notifier, and mutex serialising appending
+ */
+#define CRH_PCI_FNS_MAX			1024
+struct crh_pci_state {
+	uint16_t		fns[CRH_PCI_FNS_MAX];
+	size_t			nfns;
+	size_t			nfns_skipped;
+	struct notifier_block	nb;
+	int			nb_registered;
+	struct mutex		mutex;
+};
+
+/**
+ * cr_host_telemetry_{exit,init}() state: debugfs directory, copy of the
+ * telemetry record read back at load time, if valid, and its blob wrapper
+ */
+struct crh_telemetry_state {
+	struct dentry *		dir;
+	struct cr_telemetry *	record;
+	struct debugfs_blob_wrapper
+				blob;
+};
+
+/**
+ * cr_host_autotune() parameters and per-CPU state
+ */
+#define CRH_AUTOTUNE_NBYTES_CPU_MAX	(8 * 1024 * 1024)
+#define CRH_AUTOTUNE_NBYTES_CPU_MIN	(1 * 1024 * 1024)
+#define CRH_AUTOTUNE_NBYTES_MAX		(512 * 1024 * 1024)
+#define CRH_AUTOTUNE_NREPS		4
+#define CRH_AUTOTUNE_MEM_TYPE_ORDER	10
+struct crh_autotune_params;
+struct crh_autotune_cpu {
+	struct work_struct	work;
+	struct crh_autotune_params *
+				params;
+	void *			buf;
+	int			active;
+	u64			ns;
+};
+struct crh_autotune_params {
+	struct crh_autotune_cpu *cpus;
+	struct cra_clear_kernel *kernel;
+	size_t			nbytes, chunk_size;
+	int			nactive;
+	atomic_t		nready;
+};
+#endif /* defined(__linux__) */
 
 /**
  * CRH_PRINTK_{DEBUG,ERR,INFO}() - print string to kernel ring buffer at level {DEBUG,ERR,INFO}
@@ -159,24 +367,69 @@ struct crh_stop_cpu_params {
 /*
  * Host environment subroutines
  */
+#if defined(__linux__)
+int cr_host_autotune(void);
+# if defined(DEBUG)
+int cr_host_autotune_mem_types(void);
+# endif /* defined(DEBUG) */
+#endif /* defined(__linux__) */
 int cr_host_cdev_init(struct cr_host_state *state);
 #if defined(__linux__)
-ssize_t __attribute__((noreturn)) cr_host_cdev_write(struct file *file __attribute__((unused)), const char __user *buf __attribute__((unused)), size_t len, loff_t *ppos __attribute__((unused)));
+long cr_host_cdev_ioctl(struct file *file __attribute__((unused)), unsigned int cmd, unsigned long arg);
+int cr_host_cdev_mmap(struct file *file __attribute__((unused)), struct vm_area_struct *vma);
+ssize_t cr_host_cdev_write(struct file *file __attribute__((unused)), const char __user *buf, size_t len, loff_t *ppos __attribute__((unused)));
 #elif defined(__FreeBSD__)
 d_write_t __attribute__((noreturn)) cr_host_cdev_write;
 #endif /* defined(__linux__) || defined(__FreeBSD__) */
+int cr_host_cpu_clears(int mode, int ncpu, int ncpu_this);
 void cr_host_cpu_stop_all(void);
+#if defined(__linux__)
+void cr_host_cpu_dry_run(void);
+void cr_host_flush(void);
+void cr_host_flush_exit(void);
+int cr_host_flush_init(void);
+int cr_host_heartbeat_arm(unsigned long timeout_ms);
+void cr_host_heartbeat_disarm(void);
+void cr_host_heartbeat_exit(void);
+int cr_host_heartbeat_init(void);
+void cr_host_hints_exit(void);
+int cr_host_hints_init(void);
+#endif /* defined(__linux__) */
 int cr_host_list_append(struct crh_list *list, void **pitem);
 void cr_host_list_free(struct crh_list *list);
 void cr_host_lkm_exit(void);
 int cr_host_lkm_init(void);
+int cr_host_lkm_plan_prioritise(uintptr_t pfn_base, size_t npages, int priority);
+void cr_host_lkm_plan_sort(void);
 int cr_host_map_alloc_pt(struct cra_page_ent *pml4, uintptr_t va, enum cra_pe_bits extra_bits, int pages_nx, int level, int map_direct, struct cra_page_ent *pe, struct cra_page_ent **ppt_next);
 void cr_host_map_free(struct cra_page_ent *pml4, void (*vmfree)(void *));
 int cr_host_map_link_ram_page(uintptr_t pfn, uintptr_t va);
 int cr_host_map_link_rsvd_page(uintptr_t pfn, uintptr_t va);
 int cr_host_map_xlate_pfn(enum crh_ptl_type type, uintptr_t pfn, uintptr_t *pva);
+#if defined(__linux__)
+void cr_host_pci_exit(void);
+int cr_host_pci_init(void);
+#endif /* defined(__linux__) */
+void cr_host_pci_quiesce(void);
+int cr_host_pmap_node(uintptr_t pfn_base, uintptr_t pfn_limit, uintptr_t *ppfn_node_limit);
+#if defined(__linux__)
+void cr_host_prezero_exit(void);
+int cr_host_prezero_init(void);
+void cr_host_prezero_seal(void);
+#endif /* defined(__linux__) */
+#if defined(__linux__)
+int cr_host_reset_acpi(struct cra_reset *reset);
+void cr_host_trigger(void);
+void cr_host_trigger_exit(void);
+int cr_host_trigger_init(void);
+#endif /* defined(__linux__) */
 int cr_host_pmap_walk(struct crh_pmap_walk_params *params, uintptr_t *psection_base, uintptr_t *psection_limit, uintptr_t *psection_cur);
 void cr_host_soft_assert_fail(const char *fmt, ...);
+#if defined(__linux__)
+void cr_host_telemetry_exit(void);
+int cr_host_telemetry_init(void);
+unsigned long cr_host_tsc_khz(void);
+#endif /* defined(__linux__) */
 uintptr_t cr_host_virt_to_phys(uintptr_t va);
 void *cr_host_malloc(struct crh_malloc_state *mstate, size_t nitems, size_t size);
 void cr_host_mfree(struct crh_malloc_state *mstate, void *p);
@@ -0,0 +1,191 @@
+/*
+ * clearram -- clear system RAM and reboot on demand (for zubwolf)
+ * Copyright (C) 2017 by Lucía Andrea Illanes Albornoz <lucia@luciaillanes.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _IOCTLDEF_H_
+#define _IOCTLDEF_H_
+
+#if defined(__KERNEL__)
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <stdint.h>
+#endif /* defined(__KERNEL__) */
+
+/*
+ * /dev/clearram ioctl(2) interface, included by userland as-is
+ */
+#define CR_IOC_MAGIC		'c'
+
+/**
+ * CR_IOC_PRIORITISE: clear extent of physical RAM or of the VA space of the
+ * calling process before bulk RAM; virtual extents are translated page by
+ * page at the time of the call and should thus be mlock(2)ed
+ */
+enum cr_ioc_extent_type {
+	CR_IOC_EXTENT_PHYS	= 0,
+	CR_IOC_EXTENT_VIRT	= 1,
+};
+struct cr_ioc_extent {
+	uint64_t	base;
+	uint64_t	nbytes;
+	uint32_t	type;
+	uint32_t	reserved;
+};
+#define CR_IOC_PRIORITISE	_IOW(CR_IOC_MAGIC, 0x01, struct cr_ioc_extent)
+
+/**
+ * CR_IOC_HEARTBEAT_{ARM,DISARM}: arm the dead-man switch with a timeout in ms,
+ * at least 10, or re-arm it with a new one, or disarm it; once armed, RAM is
+ * cleared if the counter of the heartbeat page, mapped with mmap(2) of one
+ * page at offset 0 of /dev/clearram, does not advance within the timeout
+ */
+struct cr_ioc_heartbeat {
+	uint32_t	timeout_ms;
+	uint32_t	reserved;
+};
+struct cr_ioc_heartbeat_page {
+	volatile uint64_t
+			counter;
+};
+#define CR_IOC_HEARTBEAT_ARM	_IOW(CR_IOC_MAGIC, 0x02, struct cr_ioc_heartbeat)
+#define CR_IOC_HEARTBEAT_DISARM	_IO(CR_IOC_MAGIC, 0x03)
+
+/**
+ * CR_IOC_CLEAR: zero-fill up to 256 extents of physical RAM in place without
+ * resetting, each given as base PFN and page count at the user address in
+ * extents, and return the time taken in ns and the status of each, 0,
+ * -EPERM if any page of the extent is not RAM or is not free, or -EBUSY if
+ * its pages could not be taken from the page allocator; pages still in use
+ * are never zero-filled or migrated
+ */
+struct cr_ioc_clear_extent {
+	uint64_t	pfn;
+	uint64_t	npages;
+	uint64_t	ns;
+	int32_t		status;
+	uint32_t	reserved;
+};
+struct cr_ioc_clear {
+	uint64_t	extents;
+	uint32_t	nextents;
+	uint32_t	reserved;
+};
+#define CR_IOC_CLEAR		_IOW(CR_IOC_MAGIC, 0x04, struct cr_ioc_clear)
+
+/**
+ * CR_IOC_SCRUB: zero-fill the resident anonymous and shmem pages of the process
+ * given by pid or of all processes in the cgroup v2 whose path is at the user
+ * address in path, which should be stopped or frozen, and return the number of
+ * bytes zero-filled and skipped, the time taken in ns, and the throughput in
+ * MB/s; anonymous pages shared with other processes are skipped
+ */
+enum cr_ioc_scrub_type {
+	CR_IOC_SCRUB_PID	= 0,
+	CR_IOC_SCRUB_CGROUP	= 1,
+};
+struct cr_ioc_scrub {
+	uint32_t	type;
+	int32_t		pid;
+	uint64_t	path;
+	uint64_t	nbytes;
+	uint64_t	nbytes_skipped;
+	uint64_t	ns;
+	uint64_t	mbps;
+};
+#define CR_IOC_SCRUB		_IOWR(CR_IOC_MAGIC, 0x05, struct cr_ioc_scrub)
+
+/**
+ * CR_IOC_DRY_RUN: allocate gb GB of RAM, zero-fill it along the real clearing
+ * path with all CPUs stopped and switched to the map, return to the kernel
+ * instead of resetting, and return the number of bytes zero-filled, the
+ * throughput in MB/s, the latency of each phase in ns, and, at the user
+ * addresses in cpus and nodes, the bytes zero-filled and throughput of up to
+ * ncpus clearing CPUs and nnodes NUMA nodes, updating ncpus and nnodes to
+ * the number of entries returned; zero-filling stops after at most 1 s, in
+ * which case fewer bytes are returned than were allocated
+ */
+struct cr_ioc_dry_run_stat {
+	int32_t		id;
+	uint32_t	reserved;
+	uint64_t	nbytes;
+	uint64_t	mbps;
+};
+struct cr_ioc_dry_run {
+	uint32_t	gb;
+	uint32_t	reserved;
+	uint64_t	nbytes;
+	uint64_t	mbps;
+	uint64_t	ns_setup;
+	uint64_t	ns_stop;
+	uint64_t	ns_entry;
+	uint64_t	ns_clear;
+	uint64_t	ns_exit;
+	uint64_t	cpus;
+	uint64_t	nodes;
+	uint32_t	ncpus;
+	uint32_t	nnodes;
+};
+#define CR_IOC_DRY_RUN		_IOWR(CR_IOC_MAGIC, 0x06, struct cr_ioc_dry_run)
+
+/**
+ * Telemetry record written to the reserved page of physical RAM at
+ * telemetry_addr while clearing and read back from debugfs at
+ * clearram/telemetry once the LKM is loaded again; state remains
+ * CR_TELEMETRY_CLEARING if the system was reset before clearing finished,
+ * nbytes_nodes holds the bytes of chunks cleared per NUMA node, and skips
+ * up to CR_TELEMETRY_SKIPS_MAX of the nskips ranges skipped after repeated
+ * faults, all TSC values being in units of tsc_khz
+ */
+#define CR_TELEMETRY_MAGIC	0x4d4c4554524c4352ULL	/* "RCLRTELM" */
+#define CR_TELEMETRY_VERSION	1
+#define CR_TELEMETRY_NODES_MAX	64
+#define CR_TELEMETRY_SKIPS_MAX	16
+enum cr_telemetry_state {
+	CR_TELEMETRY_CLEARING	= 1,
+	CR_TELEMETRY_DONE	= 2,
+	CR_TELEMETRY_EXPIRED	= 3,
+};
+struct cr_telemetry_skip {
+	uint64_t	pfn;
+	uint64_t	npages;
+};
+struct cr_telemetry {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	state;
+	uint64_t	tsc_khz;
+	uint64_t	tsc_trigger;
+	uint64_t	tsc_stop;
+	uint64_t	tsc_start;
+	uint64_t	tsc_end;
+	uint32_t	ncpus;
+	uint32_t	nskips;
+	uint64_t	nbytes_skipped;
+	uint64_t	nexceptions;
+	uint64_t	nnonzero;
+	uint64_t	nbytes_nodes[CR_TELEMETRY_NODES_MAX];
+	struct cr_telemetry_skip
+			skips[CR_TELEMETRY_SKIPS_MAX];
+};
+#endif /* !_IOCTLDEF_H_ */
+
+/*
+ * vim:fileencoding=utf-8 foldmethod=marker noexpandtab sw=8 ts=8 tw=120
+ */
@@ -40,6 +40,7 @@ enum cra_pe_bits {
 	CRA_PE_PAGE_SIZE	= 0x080,
 	CRA_PE_GLOBAL		= 0x100,
 };
+#define CRA_PE_PAT		0x1000	/* bit 7 in PTE, bit 12 in {PDP,PD}E w/ PS bit */
 enum cra_pe_nx {
 	CRA_NX_DISABLE		= 0,
 	CRA_NX_ENABLE		= 1,
@@ -70,6 +71,28 @@ struct cra_page_ent_2M {
 	enum cra_pe_nx		nx:1;
 } __attribute__((packed));
 
+/**
+ * Page-Attribute Table (PAT) register and memory types, as per:
+ * AMD64 Architecture Programmer’s Manual, Volume 2: System Programming
+ * Section 7.8.
+ * The PAT is programmed such that CRA_PE_{WRITE_THROUGH,CACHE_DISABLE}
+ * retain their power-on meanings (WT, UC-) and CRA_PE_PAT selects WC.
+ */
+#define CRA_PAT_MSR		0x277
+enum cra_pat_type {
+	CRA_PAT_UC		= 0x00,
+	CRA_PAT_WC		= 0x01,
+	CRA_PAT_WT		= 0x04,
+	CRA_PAT_WP		= 0x05,
+	CRA_PAT_WB		= 0x06,
+	CRA_PAT_UCMINUS		= 0x07,
+};
+#define CRA_PAT_VALUE						\
+	(((uint64_t)CRA_PAT_WB << 0) | ((uint64_t)CRA_PAT_WT << 8)	\
+	| ((uint64_t)CRA_PAT_UCMINUS << 16) | ((uint64_t)CRA_PAT_UC << 24)\
+	| ((uint64_t)CRA_PAT_WC << 32) | ((uint64_t)CRA_PAT_WT << 40)	\
+	| ((uint64_t)CRA_PAT_UCMINUS << 48) | ((uint64_t)CRA_PAT_UC << 56))
+
 /**
  * PFN and VA manipulation constants
  */
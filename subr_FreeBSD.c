@@ -43,7 +43,7 @@ int cr_host_cdev_init(struct cr_host_state *state)
 
 int __attribute__((noreturn)) cr_host_cdev_write(struct cdev *dev __unused, struct uio *uio __unused, int ioflag __unused)
 {
-	cr_clear_clear();
+	cr_clear_cpu_entry();
 	__builtin_unreachable();
 }
 
@@ -64,6 +64,18 @@ void cr_host_cpu_stop_all(void)
 #endif /* !defined(SMP) */
 }
 
+/**
+ * cr_host_pci_quiesce() - disable bus mastering on all PCI functions
+ *
+ * Not implemented.
+ *
+ * Return: Nothing
+ */
+
+void cr_host_pci_quiesce(void)
+{
+}
+
 /**
  * cr_host_lkm_exit() - OS-dependent kernel module exit point
  *
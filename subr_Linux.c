@@ -19,6 +19,208 @@
 
 #include "clearram.h"
 
+/**
+ * cr_host_autotune() - select fastest zero-filling kernel, chunk size, and SMP mode
+ *
+ * Benchmark each zero-filling kernel supported by the CPU, or only the
+ * kernel selected by name, at each chunk size in crp_host_autotune_chunk_sizes
+ * and with each SMP clearing mode on per-CPU scratch buffers local to the
+ * NUMA node of each CPU. The fastest combination is stored in cr_host_state
+ * along with its throughput and the predicted time to clear all mapped RAM.
+ *
+ * Return: 0 on success, <0 otherwise
+ */
+static const size_t crp_host_autotune_chunk_sizes[] = {
+	64 * 1024, 2 * 1024 * 1024, CRH_AUTOTUNE_NBYTES_CPU_MAX,
+};
+static void crp_host_autotune_work(struct work_struct *work) {
+	struct crh_autotune_cpu *cpu;
+	struct crh_autotune_params *params;
+	size_t nrep, off;
+	u64 ns_base;
+
+	cpu = container_of(work, struct crh_autotune_cpu, work);
+	params = cpu->params;
+	atomic_inc(&params->nready);
+	while (atomic_read(&params->nready) < params->nactive) {
+		cpu_relax();
+	}
+	kernel_fpu_begin();
+	ns_base = ktime_get_ns();
+	for (nrep = 0; nrep < CRH_AUTOTUNE_NREPS; nrep++) {
+		for (off = 0; off < params->nbytes; off += params->chunk_size) {
+			cr_amd64_clear(params->kernel,
+				(uintptr_t)cpu->buf + off, params->chunk_size);
+		}
+	}
+	cpu->ns = ktime_get_ns() - ns_base;
+	kernel_fpu_end();
+}
+static unsigned long crp_host_autotune_run(struct crh_autotune_params *params, int mode, int ncpu_this) {
+	int ncpu;
+	u64 ns_max;
+
+	params->nactive = 0;
+	atomic_set(&params->nready, 0);
+	for_each_online_cpu(ncpu) {
+		params->cpus[ncpu].active = cr_host_cpu_clears(mode, ncpu, ncpu_this);
+		params->nactive += params->cpus[ncpu].active;
+	}
+	for_each_online_cpu(ncpu) {
+		if (params->cpus[ncpu].active) {
+			params->cpus[ncpu].ns = 0;
+			queue_work_on(ncpu, system_highpri_wq, &params->cpus[ncpu].work);
+		}
+	}
+	for (ns_max = 1, ncpu = 0; ncpu < nr_cpu_ids; ncpu++) {
+		if (params->cpus[ncpu].active) {
+			flush_work(&params->cpus[ncpu].work);
+			ns_max = max(ns_max, params->cpus[ncpu].ns);
+		}
+	}
+	return (params->nactive * params->nbytes * CRH_AUTOTUNE_NREPS * 1000) / ns_max;
+}
+
+int cr_host_autotune(void)
+{
+	struct crh_autotune_params params;
+	struct cra_clear_kernel *kernel, *kernel_best;
+	int err, mode, mode_best, nkernel, ncpu, ncpu_this;
+	size_t nchunk, chunk_size_best;
+	unsigned long mbps, mbps_best;
+
+	err = 0;
+	memset(&params, 0, sizeof(params));
+	if (!(params.cpus = kcalloc(nr_cpu_ids, sizeof(*params.cpus), GFP_KERNEL))) {
+		return -ENOMEM;
+	}
+	cpus_read_lock();
+	for (params.nbytes = CRH_AUTOTUNE_NBYTES_CPU_MAX;
+			(params.nbytes > CRH_AUTOTUNE_NBYTES_CPU_MIN)
+			&& ((num_online_cpus() * params.nbytes) > CRH_AUTOTUNE_NBYTES_MAX);
+			params.nbytes /= 2) {
+	}
+	for_each_online_cpu(ncpu) {
+		INIT_WORK(&params.cpus[ncpu].work, crp_host_autotune_work);
+		params.cpus[ncpu].params = &params;
+		if (!(params.cpus[ncpu].buf = vmalloc_node(params.nbytes, cpu_to_node(ncpu)))) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+	kernel_best = NULL, chunk_size_best = 0, mode_best = CRC_SMP_NONE, mbps_best = 0;
+	ncpu_this = get_cpu();
+	put_cpu();
+	for (nkernel = 0; nkernel < CRA_CLEAR_KERNELS; nkernel++) {
+		kernel = &cr_amd64_clear_kernels[nkernel];
+		if (cr_amd64_clear_kernel_select(kernel->name) != kernel) {
+			continue;
+		} else
+		if (cr_host_state.host_clear_kernel_name
+		&&  cr_host_state.host_clear_kernel_name[0]
+		&&  (kernel != cr_host_state.clear_kernel)) {
+			continue;
+		}
+		for (nchunk = 0; nchunk < ARRAY_SIZE(crp_host_autotune_chunk_sizes); nchunk++) {
+			params.kernel = kernel;
+			params.chunk_size = min(crp_host_autotune_chunk_sizes[nchunk], params.nbytes);
+			for (mode = CRC_SMP_NONE; mode <= CRC_SMP_CORES; mode++) {
+				mbps = crp_host_autotune_run(&params, mode, ncpu_this);
+				CRH_PRINTK_DEBUG("%s zero-filling kernel, chunk size %zu, SMP mode %d: %lu MB/s",
+					kernel->name, params.chunk_size, mode, mbps);
+				if (mbps > mbps_best) {
+					kernel_best = kernel;
+					chunk_size_best = params.chunk_size;
+					mode_best = mode;
+					mbps_best = mbps;
+				}
+			}
+		}
+	}
+	if (kernel_best) {
+		cr_host_state.clear_kernel = kernel_best;
+		cr_host_state.clear_chunk_size = chunk_size_best;
+		cr_host_state.clear_smp_mode = mode_best;
+		cr_host_state.host_autotune_mbps = mbps_best;
+		cr_host_state.host_autotune_eta_ms =
+			cr_host_state.clear_va_top / (mbps_best * 1000);
+		CRH_PRINTK_INFO("selected %s zero-filling kernel, chunk size %zu, SMP mode %d: %lu MB/s, predicted clearing time %lu ms",
+			kernel_best->name, chunk_size_best, mode_best,
+			mbps_best, cr_host_state.host_autotune_eta_ms);
+	}
+out:	cpus_read_unlock();
+	for (ncpu = 0; ncpu < nr_cpu_ids; ncpu++) {
+		if (params.cpus[ncpu].buf) {
+			vfree(params.cpus[ncpu].buf);
+		}
+	}
+	kfree(params.cpus);
+	return err;
+}
+
+#if defined(DEBUG)
+/**
+ * cr_host_autotune_mem_types() - report zero-filling throughput per memory type
+ *
+ * Zero-fill a scratch buffer with the selected zero-filling kernel after
+ * setting its memory type to each of those selectable w/ memtype= in turn
+ * and print the throughput measured for each to the kernel ring buffer.
+ * The memory type is reset to WB after each, as PAT memory type tracking
+ * rejects changing it from one non-WB type to another.
+ *
+ * Return: 0 on success, <0 otherwise
+ */
+static const struct {
+	const char *	name;
+	int		(*set_memory)(unsigned long, int);
+} crp_host_autotune_mem_types[] = {
+	{"uc", set_memory_uc},
+	{"wc", set_memory_wc},
+	{"wt", set_memory_wt},
+	{"wb", set_memory_wb},
+};
+
+int cr_host_autotune_mem_types(void)
+{
+	struct page *pages;
+	unsigned long va;
+	int err, npages;
+	size_t nmem_type, nrep, nbytes;
+	u64 ns_base, ns;
+
+	if (!(pages = alloc_pages(GFP_KERNEL, CRH_AUTOTUNE_MEM_TYPE_ORDER))) {
+		return -ENOMEM;
+	}
+	va = (unsigned long)page_address(pages);
+	npages = 1 << CRH_AUTOTUNE_MEM_TYPE_ORDER;
+	nbytes = npages * PAGE_SIZE;
+	for (err = 0, nmem_type = 0;
+			nmem_type < ARRAY_SIZE(crp_host_autotune_mem_types);
+			nmem_type++) {
+		if ((err = crp_host_autotune_mem_types[nmem_type].set_memory(
+				va, npages)) < 0) {
+			break;
+		}
+		kernel_fpu_begin();
+		ns_base = ktime_get_ns();
+		for (nrep = 0; nrep < CRH_AUTOTUNE_NREPS; nrep++) {
+			cr_amd64_clear(cr_host_state.clear_kernel, va, nbytes);
+		}
+		ns = max(ktime_get_ns() - ns_base, (u64)1);
+		kernel_fpu_end();
+		CRH_PRINTK_DEBUG("%s zero-filling kernel, %s memory type: %lu MB/s",
+			cr_host_state.clear_kernel->name,
+			crp_host_autotune_mem_types[nmem_type].name,
+			(unsigned long)((nbytes * CRH_AUTOTUNE_NREPS * 1000) / ns));
+		if ((err = set_memory_wb(va, npages)) < 0) {
+			return err;			/* Leak rather than free non-WB pages */
+		}
+	}
+	__free_pages(pages, CRH_AUTOTUNE_MEM_TYPE_ORDER);
+	return err;
+}
+#endif /* defined(DEBUG) */
+
 /**
  * cr_host_cdev_init() - create character device node and related structures
  *
@@ -32,7 +234,11 @@ int cr_host_cdev_init(struct cr_host_state *state)
 	if (state->host_cdev_major < 0) {
 		return state->host_cdev_major;
 	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	state->host_cdev_class = class_create("clearram");
+#else
 	state->host_cdev_class = class_create(THIS_MODULE, "clearram");
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0) */
 	if (IS_ERR(state->host_cdev_class)) {
 		unregister_chrdev(state->host_cdev_major, "clearram");
 		return PTR_ERR(state->host_cdev_class);
@@ -48,92 +254,2231 @@ int cr_host_cdev_init(struct cr_host_state *state)
 	}
 }
 
+static DEFINE_MUTEX(crp_host_plan_mutex);
+
 /**
- * cr_host_cdev_write() - character device write(2) file operation subroutine
+ * crp_host_cdev_prioritise() - CR_IOC_PRIORITISE ioctl(2) subroutine
  *
- * Call cr_clear() upon write(2) to the character device node, which will
- * not return.
+ * Raise the extent of physical RAM or of the VA space of the calling
+ * process given to CRC_PRIORITY_USER in the clear plan. Virtual extents of
+ * at most CRH_PRIORITISE_VIRT_MAX_MB are translated in batches of
+ * CRH_PRIORITISE_BATCH_PAGES, between which the calling thread may be
+ * rescheduled or killed, and coalesced into runs of contiguous PFNs.
  *
- * Return: number of bytes written, <0 on error
+ * Return: 0 on success, <0 on failure
  */
 
-ssize_t __attribute__((noreturn)) cr_host_cdev_write(struct file *file __attribute__((unused)), const char __user *buf __attribute__((unused)), size_t len, loff_t *ppos __attribute__((unused)))
-{
-	cr_clear_cpu_entry();
-	__builtin_unreachable();
+static int crp_host_cdev_prioritise(struct cr_ioc_extent *extent) {
+	int err, npage, npages;
+	struct page *pages[CRH_PRIORITISE_BATCH_PAGES];
+	uintptr_t pfn, pfn_run, va, va_limit;
+	size_t npages_run;
+
+	if ((extent->nbytes == 0)
+	||  ((extent->base + extent->nbytes) < extent->base)) {
+		return -EINVAL;
+	}
+	switch (extent->type) {
+	case CR_IOC_EXTENT_PHYS:
+		return cr_host_lkm_plan_prioritise(PFN_DOWN(extent->base),
+			PFN_UP(extent->base + extent->nbytes) - PFN_DOWN(extent->base),
+			CRC_PRIORITY_USER);
+	case CR_IOC_EXTENT_VIRT:
+		if (extent->nbytes > (CRH_PRIORITISE_VIRT_MAX_MB * 1024ULL * 1024ULL)) {
+			return -EINVAL;
+		}
+		va = extent->base & PAGE_MASK;
+		va_limit = PAGE_ALIGN(extent->base + extent->nbytes);
+		for (pfn_run = 0, npages_run = 0; va < va_limit; va += npages << PAGE_SHIFT) {
+			npages = min_t(size_t, CRH_PRIORITISE_BATCH_PAGES, (va_limit - va) >> PAGE_SHIFT);
+			if ((npages = get_user_pages_fast(va, npages, 0, pages)) <= 0) {
+				return -EFAULT;
+			}
+			for (npage = 0, err = 0; npage < npages; npage++) {
+				pfn = page_to_pfn(pages[npage]);
+				put_page(pages[npage]);
+				if (err < 0) {
+					continue;
+				} else
+				if (npages_run && (pfn == (pfn_run + npages_run))) {
+					npages_run++;
+					continue;
+				} else
+				if (npages_run && ((err = cr_host_lkm_plan_prioritise(
+						pfn_run, npages_run, CRC_PRIORITY_USER)) < 0)) {
+					continue;
+				}
+				pfn_run = pfn, npages_run = 1;
+			}
+			if (err < 0) {
+				return err;
+			} else
+			if (fatal_signal_pending(current)) {
+				return -EINTR;
+			} else {
+				cond_resched();
+			}
+		}
+		return cr_host_lkm_plan_prioritise(pfn_run, npages_run, CRC_PRIORITY_USER);
+	default:
+		return -EINVAL;
+	}
 }
 
-#if defined(CONFIG_SMP)
 /**
- * crp_host_cpu_stop_one() - stop single CPU with serialisation
- * @info:	pointer to cr_cpu_stop_one() parameters
+ * crp_host_cdev_{rsvd,clear_check,clear_zero,clear}() - CR_IOC_CLEAR ioctl(2) subroutines
  *
- * Return: Nothing
+ * Zero-fill each extent of physical RAM given in place with the
+ * zero-filling kernel, in batches of CRH_CLEAR_BATCH_PAGES between which
+ * the calling thread may be rescheduled or killed, once all of its pages
+ * have been found in the clear plan and to be free, i.e. neither referenced
+ * nor mapped, and return the time taken for and the status of each extent.
+ * Each batch is taken from the page allocator with alloc_contig_range()
+ * before it is zero-filled and freed afterwards, so that no page is handed
+ * out while it is being zero-filled.
+ *
+ * Return: 0 on success, <0 on failure
  */
-static void crp_host_cpu_stop_one(void *info) {
-	struct crh_stop_cpu_params *params;
 
-	__asm(
-		"\t	cli\n");
-	params = info;
-	spin_lock(&params->lock);
-	params->ncpus_stopped++;
-	spin_unlock(&params->lock);
-	__asm(
-		"\t1:	hlt\n"
-		"\t	jmp 1b\n");
+static int crp_host_cdev_rsvd(uintptr_t pfn) {
+	uintptr_t va;
+
+	return (cr_host_map_xlate_pfn(CRH_PTL_PAGE_TABLE, pfn, &va) == 0)
+	    || (cr_host_map_xlate_pfn(CRH_PTL_RSVD_PAGE, pfn, &va) == 0);
+}
+
+static int crp_host_cdev_clear_check(uintptr_t pfn_base, size_t npages) {
+	struct crc_plan_ent *ent;
+	struct page *page;
+	uintptr_t pfn, pfn_limit, pfn_ent_limit;
+	size_t nent;
+
+	for (pfn = pfn_base, pfn_limit = pfn_base + npages; pfn < pfn_limit;) {
+		for (nent = 0, pfn_ent_limit = 0; nent < cr_host_state.clear_nplan; nent++) {
+			ent = CRHS_PLAN_HOST(nent);
+			if ((pfn >= ent->pfn)
+			&&  (pfn < (ent->pfn + (ent->nbytes / PAGE_SIZE)))) {
+				pfn_ent_limit = ent->pfn + (ent->nbytes / PAGE_SIZE);
+				break;
+			}
+		}
+		if (!pfn_ent_limit) {
+			return -EPERM;
+		}
+		for (; (pfn < pfn_limit) && (pfn < pfn_ent_limit); pfn++) {
+			if (!pfn_valid(pfn) || crp_host_cdev_rsvd(pfn)) {
+				return -EPERM;
+			} else
+			if (PageReserved((page = pfn_to_page(pfn)))
+			||  page_count(page) || page_mapped(page)) {
+				return -EPERM;
+			}
+		}
+	}
+	return 0;
+}
+
+static int crp_host_cdev_clear_zero(uintptr_t pfn_base, size_t npages) {
+	uintptr_t pfn;
+	size_t nbatch;
+
+	for (pfn = pfn_base; pfn < (pfn_base + npages); pfn += nbatch) {
+		nbatch = min_t(size_t, CRH_CLEAR_BATCH_PAGES, pfn_base + npages - pfn);
+		if (page_zone(pfn_to_page(pfn)) != page_zone(pfn_to_page(pfn + nbatch - 1))) {
+			return -EPERM;
+		} else
+		if (alloc_contig_range(pfn, pfn + nbatch, MIGRATE_MOVABLE, GFP_KERNEL) < 0) {
+			return -EBUSY;
+		}
+		kernel_fpu_begin();
+		cr_amd64_clear(cr_host_state.clear_kernel,
+			(uintptr_t)pfn_to_kaddr(pfn), nbatch * PAGE_SIZE);
+		kernel_fpu_end();
+		free_contig_range(pfn, nbatch);
+		if (fatal_signal_pending(current)) {
+			return -EINTR;
+		} else {
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static int crp_host_cdev_clear(struct cr_ioc_clear *clear) {
+	struct cr_ioc_clear_extent extent, __user *uextent;
+	size_t nextent;
+	u64 ns_base;
+
+	if (clear->nextents > CRH_CLEAR_EXTENTS_MAX) {
+		return -EINVAL;
+	}
+	uextent = u64_to_user_ptr(clear->extents);
+	for (nextent = 0; nextent < clear->nextents; nextent++, uextent++) {
+		if (copy_from_user(&extent, uextent, sizeof(extent))) {
+			return -EFAULT;
+		} else
+		if ((extent.npages == 0)
+		||  ((extent.pfn + extent.npages) < extent.pfn)) {
+			extent.status = -EINVAL;
+		} else {
+			mutex_lock(&crp_host_plan_mutex);
+			extent.status = crp_host_cdev_clear_check(extent.pfn, extent.npages);
+			mutex_unlock(&crp_host_plan_mutex);
+		}
+		ns_base = ktime_get_ns();
+		if (extent.status == 0) {
+			extent.status = crp_host_cdev_clear_zero(extent.pfn, extent.npages);
+		}
+		extent.ns = ktime_get_ns() - ns_base;
+		if (copy_to_user(uextent, &extent, sizeof(extent))) {
+			return -EFAULT;
+		} else
+		if (extent.status == -EINTR) {
+			return -EINTR;
+		}
+	}
+	return 0;
 }
-#endif /* defined(CONFIG_SMP) */
 
 /**
- * cr_host_cpu_stop_all() - stop all CPUs with serialisation
+ * crp_host_cdev_scrub{,_work,_batch,_skip,_next,_mm,_cgroup}() - CR_IOC_SCRUB ioctl(2) subroutines
  *
- * Return: Nothing
+ * Pin the resident pages of the readable mappings, other than shared
+ * mappings of files outside of tmpfs, of the process or of each process in
+ * the cgroup given in batches of CRH_SCRUB_BATCH_PAGES, and zero-fill each
+ * batch with the zero-filling kernel, on up to as many CPUs as are online
+ * in parallel if the resident size of the address space is at least
+ * CRH_SCRUB_PARALLEL_MB. The page tables are walked to the next present
+ * entry past holes, and pages are pinned without faulting in swapped out
+ * pages or shmem holes. The zero page, pages of the map, file pages of
+ * private mappings, and anonymous pages mapped more than once or merged by
+ * KSM are skipped.
+ *
+ * Return: 0 on success, <0 on failure
  */
 
-void cr_host_cpu_stop_all(void)
+static void crp_host_cdev_scrub_work(struct work_struct *work) {
+	struct crh_scrub_work *sw;
+	size_t npage;
+
+	sw = container_of(work, struct crh_scrub_work, work);
+	kernel_fpu_begin();
+	for (npage = 0; npage < sw->npages; npage++) {
+		cr_amd64_clear(cr_host_state.clear_kernel,
+			(uintptr_t)page_address(sw->pages[npage]), PAGE_SIZE);
+	}
+	kernel_fpu_end();
+	unpin_user_pages_dirty_lock(sw->pages, sw->npages, true);
+	sw->npages = 0;
+}
+
+static void crp_host_cdev_scrub_batch(struct crh_scrub_state *state) {
+	struct crh_scrub_work *sw;
+
+	sw = &state->works[state->nwork];
+	if (sw->npages == 0) {
+		return;
+	} else
+	if (state->nworks == 1) {
+		crp_host_cdev_scrub_work(&sw->work);
+	} else {
+		queue_work(system_unbound_wq, &sw->work);
+		state->nwork = (state->nwork + 1) % state->nworks;
+		flush_work(&state->works[state->nwork].work);
+	}
+	cond_resched();
+}
+
+static int crp_host_cdev_scrub_skip(struct page *page, int anon_only) {
+	if (is_zero_pfn(page_to_pfn(page))
+	||  crp_host_cdev_rsvd(page_to_pfn(page))) {
+		return 1;
+	} else
+	if (!PageAnon(page)) {
+		return anon_only;
+	} else {
+		return PageKsm(page) || (page_mapcount(page) > 1);
+	}
+}
+
+static unsigned long crp_host_cdev_scrub_next(struct mm_struct *mm, unsigned long va, unsigned long va_limit) {
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud, pud_val;
+	pmd_t *pmd;
+
+	while (va < va_limit) {
+		pgd = pgd_offset(mm, va);
+		if (pgd_none(READ_ONCE(*pgd))) {
+			va = pgd_addr_end(va, va_limit);
+			continue;
+		}
+		p4d = p4d_offset(pgd, va);
+		if (p4d_none(READ_ONCE(*p4d))) {
+			va = p4d_addr_end(va, va_limit);
+			continue;
+		}
+		pud = pud_offset(p4d, va);
+		if (pud_none((pud_val = READ_ONCE(*pud)))) {
+			va = pud_addr_end(va, va_limit);
+			continue;
+		} else
+		if (pud_leaf(pud_val)) {
+			break;
+		}
+		pmd = pmd_offset(pud, va);
+		if (pmd_none(READ_ONCE(*pmd))) {
+			va = pmd_addr_end(va, va_limit);
+			continue;
+		}
+		break;
+	}
+	return min(va, va_limit);
+}
+
+static int crp_host_cdev_scrub_mm(struct crh_scrub_state *state, struct mm_struct *mm) {
+	struct crh_scrub_work *sw;
+	struct vm_area_struct *vma;
+	unsigned long va, npages_rss;
+	long npages, npage;
+	size_t nwork;
+	int err;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+	VMA_ITERATOR(vmi, mm, 0);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0) */
+
+	npages_rss = get_mm_counter(mm, MM_ANONPAGES) + get_mm_counter(mm, MM_SHMEMPAGES);
+	state->nworks = ((npages_rss * PAGE_SIZE) >= (CRH_SCRUB_PARALLEL_MB * 1024 * 1024))
+		? min_t(size_t, num_online_cpus(), CRH_SCRUB_WORKS_MAX) : 1;
+	state->nwork = 0;
+	err = 0;
+	mmap_read_lock(mm);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+	for_each_vma(vmi, vma) {
+#else
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0) */
+		if (err) {
+			break;
+		} else
+		if ((vma->vm_flags & (VM_IO | VM_PFNMAP)) || !(vma->vm_flags & VM_READ)) {
+			continue;
+		} else
+		if (vma->vm_file && (vma->vm_flags & VM_SHARED)
+		&&  (file_inode(vma->vm_file)->i_sb->s_magic != TMPFS_MAGIC)) {
+			continue;
+		}
+		for (va = vma->vm_start; va < vma->vm_end;) {
+			if (fatal_signal_pending(current)) {
+				err = -EINTR;
+				break;
+			} else {
+				cond_resched();
+			}
+			if ((va = crp_host_cdev_scrub_next(mm, va, vma->vm_end)) >= vma->vm_end) {
+				break;
+			}
+			sw = &state->works[state->nwork];
+			npages = min_t(long, CRH_SCRUB_BATCH_PAGES - sw->npages,
+				(vma->vm_end - va) >> PAGE_SHIFT);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+			npages = pin_user_pages_remote(mm, va, npages, FOLL_DUMP | FOLL_NOFAULT,
+				&sw->pages[sw->npages], NULL);
+#else
+			npages = pin_user_pages_remote(mm, va, npages, FOLL_DUMP | FOLL_NOFAULT,
+				&sw->pages[sw->npages], NULL, NULL);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0) */
+			if (npages <= 0) {
+				va += PAGE_SIZE;
+				continue;
+			}
+			for (npage = 0; npage < npages; npage++) {
+				if (crp_host_cdev_scrub_skip(sw->pages[sw->npages],
+						!(vma->vm_flags & VM_SHARED))) {
+					unpin_user_page(sw->pages[sw->npages]);
+					state->nbytes_skipped += PAGE_SIZE;
+					memmove(&sw->pages[sw->npages], &sw->pages[sw->npages + 1],
+						(npages - npage - 1) * sizeof(sw->pages[0]));
+				} else {
+					sw->npages++;
+					state->nbytes += PAGE_SIZE;
+				}
+			}
+			va += npages << PAGE_SHIFT;
+			if (sw->npages == CRH_SCRUB_BATCH_PAGES) {
+				crp_host_cdev_scrub_batch(state);
+			}
+		}
+	}
+	mmap_read_unlock(mm);
+	crp_host_cdev_scrub_batch(state);
+	for (nwork = 0; nwork < state->nworks; nwork++) {
+		flush_work(&state->works[nwork].work);
+	}
+	return err;
+}
+
+static int crp_host_cdev_scrub_cgroup(struct crh_scrub_state *state, const char __user *upath) {
+	struct cgroup *cgrp;
+	struct task_struct *task;
+	struct mm_struct **mms, *mm;
+	size_t nmm, nmms, nmms_max;
+	char *path;
+	int err;
+
+	if (IS_ERR((path = strndup_user(upath, PATH_MAX)))) {
+		return PTR_ERR(path);
+	} else {
+		cgrp = cgroup_get_from_path(path);
+		kfree(path);
+		if (IS_ERR(cgrp)) {
+			return PTR_ERR(cgrp);
+		}
+	}
+	nmms_max = 0;
+	rcu_read_lock();
+	for_each_process(task) {
+		nmms_max += task_under_cgroup_hierarchy(task, cgrp);
+	}
+	rcu_read_unlock();
+	if (!(mms = kcalloc(nmms_max + 1, sizeof(*mms), GFP_KERNEL))) {
+		cgroup_put(cgrp);
+		return -ENOMEM;
+	}
+	nmms = 0;
+	rcu_read_lock();
+	for_each_process(task) {
+		if ((nmms == nmms_max) || !task_under_cgroup_hierarchy(task, cgrp)) {
+			continue;
+		}
+		for (nmm = 0; (nmm < nmms) && (mms[nmm] != READ_ONCE(task->mm)); nmm++) {
+		}
+		if ((nmm == nmms) && (mm = get_task_mm(task))) {
+			mms[nmms++] = mm;
+		}
+	}
+	rcu_read_unlock();
+	cgroup_put(cgrp);
+	for (err = 0, nmm = 0; nmm < nmms; nmm++) {
+		if (!err) {
+			err = crp_host_cdev_scrub_mm(state, mms[nmm]);
+		}
+		mmput(mms[nmm]);
+	}
+	kfree(mms);
+	return err;
+}
+
+static int crp_host_cdev_scrub(struct cr_ioc_scrub *scrub) {
+	struct crh_scrub_state state;
+	struct pid *pid;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	size_t nwork;
+	u64 ns_base;
+	int err;
+
+	memset(&state, 0, sizeof(state));
+	if (!(state.works = vzalloc(CRH_SCRUB_WORKS_MAX * sizeof(*state.works)))) {
+		return -ENOMEM;
+	}
+	for (nwork = 0; nwork < CRH_SCRUB_WORKS_MAX; nwork++) {
+		INIT_WORK(&state.works[nwork].work, crp_host_cdev_scrub_work);
+	}
+	ns_base = ktime_get_ns();
+	switch (scrub->type) {
+	case CR_IOC_SCRUB_PID:
+		pid = find_get_pid(scrub->pid);
+		task = get_pid_task(pid, PIDTYPE_PID);
+		put_pid(pid);
+		if (!task) {
+			err = -ESRCH;
+		} else
+		if (!(mm = get_task_mm(task))) {
+			put_task_struct(task);
+			err = -ESRCH;
+		} else {
+			put_task_struct(task);
+			err = crp_host_cdev_scrub_mm(&state, mm);
+			mmput(mm);
+		}
+		break;
+	case CR_IOC_SCRUB_CGROUP:
+		err = crp_host_cdev_scrub_cgroup(&state, u64_to_user_ptr(scrub->path));
+		break;
+	default:
+		err = -EINVAL;
+		break;
+	}
+	scrub->nbytes = state.nbytes;
+	scrub->nbytes_skipped = state.nbytes_skipped;
+	scrub->ns = max(ktime_get_ns() - ns_base, (u64)1);
+	scrub->mbps = (state.nbytes * 1000) / scrub->ns;
+	vfree(state.works);
+	return err;
+}
+
+/**
+ * crp_host_cdev_dry_run{,_ns,_stats}() - CR_IOC_DRY_RUN ioctl(2) subroutines
+ *
+ * Allocate gb GB of RAM in blocks spread evenly across NUMA nodes with RAM,
+ * and append one entry per run of pages contiguous in the map to the clear
+ * plan, past its end. The chunk queues are set up for these entries only
+ * while the real ones are set aside, and the plan mutex is held throughout,
+ * so that the clear plan itself remains untouched and a concurrent trigger
+ * restores the real chunk queues before clearing. All CPUs are then stopped
+ * and the entries zero-filled along the real clearing path by
+ * cr_host_cpu_dry_run(), for at most CRC_DRY_RUN_MS_MAX, after which the
+ * per-CPU areas hold the TSCs and byte counts the results are derived from.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+
+static uint64_t crp_host_cdev_dry_run_ns(uint64_t tsc_from, uint64_t tsc_to) {
+	return (tsc_to > tsc_from)
+		? (((tsc_to - tsc_from) * 1000000) / cr_host_state.clear_tsc_khz) : 0;
+}
+
+static int crp_host_cdev_dry_run_stats(struct cr_ioc_dry_run *dry_run, uint64_t tsc_return) {
+	struct cr_ioc_dry_run_stat stat;
+	struct cr_ioc_dry_run_stat __user *stats;
+	struct crc_cpu *cpu;
+	uint64_t nbytes_nodes[CRHS_NODES_MAX], tsc_nodes[CRHS_NODES_MAX];
+	uint64_t tsc_stopped, tsc_done;
+	uint32_t nstat;
+	int ncpu, nid;
+
+	memset(nbytes_nodes, 0, sizeof(nbytes_nodes));
+	memset(tsc_nodes, 0, sizeof(tsc_nodes));
+	memset(&stat, 0, sizeof(stat));
+	stats = (struct cr_ioc_dry_run_stat __user *)(uintptr_t)dry_run->cpus;
+	for (tsc_stopped = 0, tsc_done = 0, nstat = 0, ncpu = 0;
+			ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_HOST(ncpu);
+		if (!cpu_online(ncpu) || !cpu->tsc_stopped) {
+			continue;
+		}
+		tsc_stopped = max(tsc_stopped, cpu->tsc_stopped);
+		if (!cpu->clear) {
+			continue;
+		}
+		tsc_done = max(tsc_done, cpu->tsc_done);
+		dry_run->nbytes += cpu->nbytes_cleared;
+		nbytes_nodes[cpu->nid] += cpu->nbytes_cleared;
+		tsc_nodes[cpu->nid] = max(tsc_nodes[cpu->nid], cpu->tsc_done);
+		if (nstat < dry_run->ncpus) {
+			stat.id = ncpu;
+			stat.nbytes = cpu->nbytes_cleared;
+			stat.mbps = (stat.nbytes * 1000) / max(crp_host_cdev_dry_run_ns(
+				cr_host_state.clear_tsc_start, cpu->tsc_done), (uint64_t)1);
+			if (copy_to_user(&stats[nstat++], &stat, sizeof(stat))) {
+				return -EFAULT;
+			}
+		}
+	}
+	dry_run->ncpus = nstat;
+	stats = (struct cr_ioc_dry_run_stat __user *)(uintptr_t)dry_run->nodes;
+	for (nstat = 0, nid = 0; nid < CRHS_NODES_MAX; nid++) {
+		if (nbytes_nodes[nid] && (nstat < dry_run->nnodes)) {
+			stat.id = nid;
+			stat.nbytes = nbytes_nodes[nid];
+			stat.mbps = (stat.nbytes * 1000) / max(crp_host_cdev_dry_run_ns(
+				cr_host_state.clear_tsc_start, tsc_nodes[nid]), (uint64_t)1);
+			if (copy_to_user(&stats[nstat++], &stat, sizeof(stat))) {
+				return -EFAULT;
+			}
+		}
+	}
+	dry_run->nnodes = nstat;
+	dry_run->ns_stop = crp_host_cdev_dry_run_ns(cr_host_state.clear_tsc_stop, tsc_stopped);
+	dry_run->ns_entry = crp_host_cdev_dry_run_ns(tsc_stopped, cr_host_state.clear_tsc_start);
+	dry_run->ns_clear = crp_host_cdev_dry_run_ns(cr_host_state.clear_tsc_start, tsc_done);
+	dry_run->ns_exit = crp_host_cdev_dry_run_ns(tsc_done, tsc_return);
+	dry_run->mbps = (dry_run->nbytes * 1000) / max(dry_run->ns_clear, (uint64_t)1);
+	return 0;
+}
+
+static int crp_host_cdev_dry_run(struct cr_ioc_dry_run *dry_run) {
+	struct page **pages;
+	struct crc_plan_ent *ent;
+	size_t nblock, nblocks, nblocks_node, nnodes, npage, nplan;
+	uintptr_t pfn, va;
+	uint64_t tsc_return;
+	u64 ns_base;
+	int err, nid, nnode;
+
+	dry_run->nbytes = dry_run->mbps = 0;
+	if ((dry_run->gb == 0) || (dry_run->gb > CRH_DRY_RUN_GB_MAX)) {
+		return -EINVAL;
+	} else
+	if (!cr_host_state.clear_tsc_khz) {
+		return -ENODEV;
+	}
+	nblocks = ((size_t)dry_run->gb << 30) >> (PAGE_SHIFT + CRH_DRY_RUN_ORDER);
+	if (!(pages = kvcalloc(nblocks, sizeof(*pages), GFP_KERNEL))) {
+		return -ENOMEM;
+	}
+	ns_base = ktime_get_ns();
+	mutex_lock(&crp_host_plan_mutex);
+	if (cr_host_state.host_triggered) {
+		err = -EBUSY;
+		goto out;
+	}
+	nnodes = num_node_state(N_MEMORY), nblock = 0, nnode = 0, err = 0;
+	for_each_node_state(nid, N_MEMORY) {
+		nblocks_node = (nblocks / nnodes) + ((size_t)nnode++ < (nblocks % nnodes));
+		for (; !err && nblocks_node; nblocks_node--, nblock++) {
+			pages[nblock] = alloc_pages_node(nid, GFP_KERNEL | __GFP_THISNODE
+				| __GFP_NOWARN | __GFP_NORETRY, CRH_DRY_RUN_ORDER);
+			if (!pages[nblock]) {
+				err = -ENOMEM;
+			}
+		}
+	}
+	for (nblock = 0, nplan = cr_host_state.clear_nplan, ent = NULL;
+			!err && (nblock < nblocks); nblock++) {
+		nid = page_to_nid(pages[nblock]);
+		nid = ((nid >= 0) && (nid < CRHS_NODES_MAX)) ? nid : 0;
+		for (npage = 0, pfn = page_to_pfn(pages[nblock]);
+				!err && (npage < (1 << CRH_DRY_RUN_ORDER)); npage++, pfn++) {
+			if ((err = cr_host_map_xlate_pfn(CRH_PTL_RAM_PAGE, pfn, &va))) {
+				err = -ESRCH;
+			} else
+			if (ent && (ent->nid == nid)
+			&&  ((ent->pfn + (ent->nbytes >> PAGE_SHIFT)) == pfn)
+			&&  ((ent->va + ent->nbytes) == va)) {
+				ent->nbytes += PAGE_SIZE;
+			} else
+			if (nplan >= CRHS_PLAN_NENTS) {
+				err = -ENOSPC;
+			} else {
+				ent = CRHS_PLAN_HOST(nplan++);
+				CRC_INIT_PLAN_ENT(ent, va, PAGE_SIZE, pfn, nid, CRA_PS_4K, CRC_PRIORITY_BULK);
+			}
+		}
+	}
+	if (!err) {
+		for (nid = 0; nid < CRHS_NODES_MAX; nid++) {
+			cr_host_state.clear_dry_run_queues[nid] = cr_host_state.clear_queues[nid];
+		}
+		cr_host_state.clear_dry_run_nbytes_total = cr_host_state.clear_nbytes_total;
+		cr_host_state.clear_dry_run = 1;
+		cr_clear_plan_init(CRHS_PLAN_HOST(cr_host_state.clear_nplan),
+			nplan - cr_host_state.clear_nplan);
+		dry_run->ns_setup = ktime_get_ns() - ns_base;
+		cr_host_cpu_dry_run();
+		tsc_return = cr_amd64_rdtsc();
+		for (nid = 0; nid < CRHS_NODES_MAX; nid++) {
+			cr_host_state.clear_queues[nid] = cr_host_state.clear_dry_run_queues[nid];
+		}
+		cr_host_state.clear_nbytes_total = cr_host_state.clear_dry_run_nbytes_total;
+		cr_host_state.clear_dry_run = 0;
+		cr_host_state.clear_tsc_deadline = 0;
+		err = crp_host_cdev_dry_run_stats(dry_run, tsc_return);
+	}
+
+out:	mutex_unlock(&crp_host_plan_mutex);
+	for (nblock = 0; nblock < nblocks; nblock++) {
+		if (pages[nblock]) {
+			__free_pages(pages[nblock], CRH_DRY_RUN_ORDER);
+		}
+	}
+	kvfree(pages);
+	return err;
+}
+
+/**
+ * cr_host_cdev_ioctl() - character device ioctl(2) file operation subroutine
+ *
+ * Dispatch CR_IOC_PRIORITISE to crp_host_cdev_prioritise(),
+ * CR_IOC_HEARTBEAT_{ARM,DISARM} to cr_host_heartbeat_{arm,disarm}(),
+ * CR_IOC_CLEAR to crp_host_cdev_clear(), CR_IOC_SCRUB to
+ * crp_host_cdev_scrub(), and CR_IOC_DRY_RUN to crp_host_cdev_dry_run(),
+ * copying their arguments from and results to userland.
+ *
+ * Return: 0 on success, <0 on error
+ */
+
+long cr_host_cdev_ioctl(struct file *file __attribute__((unused)), unsigned int cmd, unsigned long arg)
 {
-#if defined(CONFIG_SMP)
-	int this_cpu;
-	struct crh_stop_cpu_params csc_params;
-	int ncpu_this, ncpus, ncpu, ncpus_stopped;
-
-	this_cpu = get_cpu();
-	spin_lock_init(&csc_params.lock);
-	csc_params.ncpus_stopped = 0;
-	for (ncpu = 0, ncpu_this = smp_processor_id(), ncpus = num_online_cpus();
-			ncpu < ncpus; ncpu++) {
-		if (ncpu != ncpu_this) {
-			smp_call_function_single(ncpu, crp_host_cpu_stop_one, &csc_params, 0);
-		}
-	}
-	do {
-		spin_lock(&csc_params.lock);
-		ncpus_stopped = csc_params.ncpus_stopped;
-		spin_unlock(&csc_params.lock);
-	} while (ncpus_stopped < (ncpus - 1));
-#endif /* defined(CONFIG_SMP) */
+	int err;
+	struct cr_ioc_extent extent;
+	struct cr_ioc_heartbeat heartbeat;
+	struct cr_ioc_clear clear;
+	struct cr_ioc_scrub scrub;
+	struct cr_ioc_dry_run dry_run;
+
+	switch (cmd) {
+	case CR_IOC_PRIORITISE:
+		if (copy_from_user(&extent, (void __user *)arg, sizeof(extent))) {
+			return -EFAULT;
+		}
+		mutex_lock(&crp_host_plan_mutex);
+		err = crp_host_cdev_prioritise(&extent);
+		cr_host_lkm_plan_sort();
+		mutex_unlock(&crp_host_plan_mutex);
+		return err;
+	case CR_IOC_HEARTBEAT_ARM:
+		if (copy_from_user(&heartbeat, (void __user *)arg, sizeof(heartbeat))) {
+			return -EFAULT;
+		} else {
+			return cr_host_heartbeat_arm(heartbeat.timeout_ms);
+		}
+	case CR_IOC_HEARTBEAT_DISARM:
+		cr_host_heartbeat_disarm();
+		return 0;
+	case CR_IOC_CLEAR:
+		if (copy_from_user(&clear, (void __user *)arg, sizeof(clear))) {
+			return -EFAULT;
+		} else {
+			return crp_host_cdev_clear(&clear);
+		}
+	case CR_IOC_SCRUB:
+		if (copy_from_user(&scrub, (void __user *)arg, sizeof(scrub))) {
+			return -EFAULT;
+		} else {
+			err = crp_host_cdev_scrub(&scrub);
+		}
+		if (copy_to_user((void __user *)arg, &scrub, sizeof(scrub))) {
+			return -EFAULT;
+		} else {
+			return err;
+		}
+	case CR_IOC_DRY_RUN:
+		if (copy_from_user(&dry_run, (void __user *)arg, sizeof(dry_run))) {
+			return -EFAULT;
+		} else {
+			err = crp_host_cdev_dry_run(&dry_run);
+		}
+		if (copy_to_user((void __user *)arg, &dry_run, sizeof(dry_run))) {
+			return -EFAULT;
+		} else {
+			return err;
+		}
+	default:
+		return -ENOTTY;
+	}
 }
 
 /**
- * cr_host_lkm_exit() - kernel module exit point
+ * cr_host_cdev_mmap() - character device mmap(2) file operation subroutine
  *
- * Return: Nothing
+ * Map the heartbeat page, which must be mapped whole and shared at offset 0
+ * and not executable, into the calling process. Private mappings are
+ * rejected, as stores to them would go to a copy-on-write copy the
+ * heartbeat timer never sees, and the mapping can not be made executable
+ * later with mprotect(2).
+ *
+ * Return: 0 on success, <0 on error
  */
 
-void cr_host_lkm_exit(void)
+int cr_host_cdev_mmap(struct file *file __attribute__((unused)), struct vm_area_struct *vma)
 {
-	if (cr_host_state.host_cdev_device) {
-		device_destroy(cr_host_state.host_cdev_class,
-			MKDEV(cr_host_state.host_cdev_major, 0));
+	if (!cr_host_state.host_heartbeat.page) {
+		return -ENODEV;
+	} else
+	if ((vma->vm_pgoff != 0) || ((vma->vm_end - vma->vm_start) != PAGE_SIZE)) {
+		return -EINVAL;
+	} else
+	if (!(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	} else
+	if (vma->vm_flags & VM_EXEC) {
+		return -EPERM;
+	} else {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+		vm_flags_clear(vma, VM_MAYEXEC);
+#else
+		vma->vm_flags &= ~VM_MAYEXEC;
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0) */
+		return vm_insert_page(vma, vma->vm_start, cr_host_state.host_heartbeat.page);
 	}
-	if (cr_host_state.host_cdev_class) {
-		class_destroy(cr_host_state.host_cdev_class);
+}
+
+/**
+ * cr_host_cdev_write() - character device write(2) file operation subroutine
+ *
+ * Call cr_clear() upon write(2) to the character device node, which will
+ * not return. If the data written starts with "passes=", the comma-separated
+ * list of overwrite patterns following it replaces the passes selected at
+ * load time first. Only the first trigger, here or through cr_host_trigger(), proceeds.
+ * Storage is flushed for at most flush_ms first, if set.
+ *
+ * Return: number of bytes written, <0 on error
+ */
+ssize_t cr_host_cdev_write(struct file *file __attribute__((unused)), const char __user *buf, size_t len, loff_t *ppos __attribute__((unused)))
+{
+	char str[CRH_CDEV_WRITE_MAX];
+	size_t nstr, npasses;
+	enum crc_pattern passes[CRC_PASSES_MAX];
+
+	nstr = (len < sizeof(str)) ? len : sizeof(str);
+	npasses = 0;
+	if (copy_from_user(str, buf, nstr)) {
+		return -EFAULT;
+	} else
+	if ((nstr > (sizeof("passes=") - 1))
+	&&  !strncmp(str, "passes=", sizeof("passes=") - 1)
+	&&  (cr_clear_passes_parse(&str[sizeof("passes=") - 1],
+			nstr - (sizeof("passes=") - 1), passes, &npasses) < 0)) {
+		return -EINVAL;
+	} else
+	if (__atomic_exchange_n(&cr_host_state.host_triggered, 1, __ATOMIC_ACQ_REL)) {
+		return -EBUSY;
+	} else {
+		cr_host_state.clear_tsc_trigger = cr_amd64_rdtsc();
 	}
-	if (cr_host_state.host_cdev_major) {
-		unregister_chrdev(cr_host_state.host_cdev_major, "clearram");
+	if (npasses > 0) {
+		memcpy(cr_host_state.clear_passes, passes, sizeof(passes));
+		cr_host_state.clear_npasses = npasses;
+	}
+	cr_host_flush();
+	mutex_lock(&crp_host_plan_mutex);
+	cr_host_prezero_seal();
+	cr_clear_cpu_entry();
+	__builtin_unreachable();
+}
+
+/**
+ * cr_host_cpu_clears() - determine whether CPU takes part in clearing
+ * @mode:	SMP clearing mode
+ * @ncpu:	CPU to test
+ * @ncpu_this:	boot CPU
+ *
+ * Return: 1 if CPU takes part in clearing, 0 otherwise
+ */
+
+int cr_host_cpu_clears(int mode, int ncpu, int ncpu_this)
+{
+	switch (mode) {
+	case CRC_SMP_ALL:
+		return 1;
+	case CRC_SMP_CORES:
+		return (ncpu == ncpu_this)
+		    || ((cpumask_first(topology_sibling_cpumask(ncpu)) == ncpu)
+		    &&  !cpumask_test_cpu(ncpu_this, topology_sibling_cpumask(ncpu)));
+	case CRC_SMP_NONE:
+	default:
+		return (ncpu == ncpu_this);
+	}
+}
+
+/**
+ * crp_host_cpu_nid() - get NUMA node of CPU
+ * @ncpu:	CPU to get NUMA node of
+ *
+ * Return: NUMA node of CPU, 0 if unknown
+ */
+static int crp_host_cpu_nid(int ncpu) {
+	int nid;
+
+	nid = cpu_to_node(ncpu);
+	if ((nid < 0) || (nid >= CRHS_NODES_MAX)) {
+		nid = 0;
+	}
+	return nid;
+}
+
+/**
+ * crp_host_cpu_init_one() - initialise per-CPU area of single CPU
+ * @ncpu:	CPU to initialise
+ * @ncpu_this:	boot CPU
+ *
+ * Return: Nothing
+ */
+static void crp_host_cpu_init_one(int ncpu, int ncpu_this) {
+	struct crc_cpu *cpu;
+
+	cpu = CRHS_CPU_HOST(ncpu);
+	if (cr_host_cpu_clears(cr_host_state.clear_smp_mode, ncpu, ncpu_this)) {
+		CRC_INIT_CPU(cpu, ncpu, crp_host_cpu_nid(ncpu), 1);
+		cr_host_state.clear_ncpus++;
+	} else {
+		CRC_INIT_CPU(cpu, ncpu, crp_host_cpu_nid(ncpu), 0);
+	}
+}
+
+#if defined(CONFIG_SMP)
+/**
+ * crp_host_cpu_stop_one() - stop single CPU
+ * @info:	(unused)
+ *
+ * Record the TSC at arrival in the per-CPU area of the stopped CPU, on a
+ * cache line of its own. Stopped CPUs that take part in clearing switch to
+ * the map and zero-fill chunks of RAM, all others halt.
+ *
+ * Return: Nothing
+ */
+static void crp_host_cpu_stop_one(void *info __attribute__((unused))) {
+	int ncpu;
+
+	__asm(
+		"\t	cli\n");
+	ncpu = smp_processor_id();
+	__atomic_store_n(&CRHS_CPU_HOST(ncpu)->tsc_stopped, cr_amd64_rdtsc(), __ATOMIC_RELEASE);
+	if (CRHS_CPU_HOST(ncpu)->clear) {
+		cr_clear_cpu_entry_ap(ncpu);
+	}
+	__asm(
+		"\t	wbinvd\n"
+		"\t1:	hlt\n"
+		"\t	jmp 1b\n");
+}
+#endif /* defined(CONFIG_SMP) */
+
+#if defined(CONFIG_SMP)
+/**
+ * crp_host_cpu_stop_nmi() - stop single CPU from NMI handler once triggered in kernel context
+ * @cmd:	NMI type (unused)
+ * @regs:	interrupted CPU registers (unused)
+ *
+ * Stopped CPUs that take part in clearing join it for as long as the boot
+ * CPU waits for them, switch to the map and zero-fill chunks of RAM; all
+ * others halt.
+ *
+ * Return: NMI_DONE if no CPUs are being stopped, does not return otherwise
+ */
+static int crp_host_cpu_stop_nmi(unsigned int cmd __attribute__((unused)), struct pt_regs *regs __attribute__((unused))) {
+	struct crh_trigger_state *state;
+	unsigned njoined;
+	uint64_t tsc_stopped;
+	int ncpu;
+
+	state = &cr_host_state.host_trigger_state;
+	if (!__atomic_load_n(&state->nmi_stop, __ATOMIC_ACQUIRE)) {
+		return NMI_DONE;
+	}
+	ncpu = smp_processor_id();
+	tsc_stopped = cr_amd64_rdtsc();
+	if (ncpu == cr_host_state.clear_cpu_boot) {
+		return NMI_HANDLED;
+	} else
+	if (cr_host_cpu_clears(cr_host_state.clear_smp_mode, ncpu,
+			cr_host_state.clear_cpu_boot)) {
+		njoined = __atomic_load_n(&state->nmi_njoined, __ATOMIC_RELAXED);
+		while (njoined & CRH_NMI_STOP_OPEN) {
+			if (__atomic_compare_exchange_n(&state->nmi_njoined,
+					&njoined, njoined + 1, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				CRC_INIT_CPU(CRHS_CPU_HOST(ncpu), ncpu, crp_host_cpu_nid(ncpu), 1);
+				CRHS_CPU_HOST(ncpu)->tsc_stopped = tsc_stopped;
+				cr_clear_cpu_entry_ap(ncpu);
+			}
+		}
+	}
+	__asm(
+		"\t	wbinvd\n"
+		"\t1:	hlt\n"
+		"\t	jmp 1b\n");
+	return NMI_HANDLED;
+}
+
+/**
+ * crp_host_cpu_stop_all_nmi() - stop all CPUs with NMIs
+ * @ncpu_this:	boot CPU
+ *
+ * Send an NMI to all active CPUs other than the boot CPU, including those
+ * already stopped in panic context and thus no longer online, without
+ * relying on them servicing IPIs, and wait up to CRH_NMI_STOP_TIMEOUT_US
+ * for those taking part in clearing to join.
+ *
+ * Return: Nothing
+ */
+static void crp_host_cpu_stop_all_nmi(int ncpu_this) {
+	struct crh_trigger_state *state;
+	int ncpu;
+	unsigned ncpus;
+	uint64_t tsc_limit;
+
+	state = &cr_host_state.host_trigger_state;
+	for_each_cpu(ncpu, cpu_active_mask) {
+		CRC_INIT_CPU(CRHS_CPU_HOST(ncpu), ncpu, crp_host_cpu_nid(ncpu),
+			(ncpu == ncpu_this));
+	}
+	CRHS_CPU_HOST(ncpu_this)->tsc_stopped = cr_host_state.clear_tsc_stop;
+	cpumask_copy(&state->nmi_mask, cpu_active_mask);
+	cpumask_clear_cpu(ncpu_this, &state->nmi_mask);
+	for (ncpus = 0, ncpu = cpumask_first(&state->nmi_mask);
+			ncpu < nr_cpu_ids; ncpu = cpumask_next(ncpu, &state->nmi_mask)) {
+		ncpus += cr_host_cpu_clears(cr_host_state.clear_smp_mode, ncpu, ncpu_this);
+	}
+	__atomic_store_n(&state->nmi_njoined, CRH_NMI_STOP_OPEN, __ATOMIC_RELAXED);
+	__atomic_store_n(&state->nmi_stop, 1, __ATOMIC_RELEASE);
+	if (!cpumask_empty(&state->nmi_mask)) {
+		apic->send_IPI_mask(&state->nmi_mask, NMI_VECTOR);
+	}
+	tsc_limit = cr_amd64_rdtsc()
+		+ ((CRH_NMI_STOP_TIMEOUT_US * cr_host_state.clear_tsc_khz) / 1000);
+	while (((__atomic_load_n(&state->nmi_njoined, __ATOMIC_ACQUIRE)
+			& ~CRH_NMI_STOP_OPEN) < ncpus)
+	&&     (cr_amd64_rdtsc() < tsc_limit)) {
+		__asm volatile("\tpause\n");
+	}
+	ncpus = __atomic_fetch_and(&state->nmi_njoined, ~CRH_NMI_STOP_OPEN,
+		__ATOMIC_ACQ_REL) & ~CRH_NMI_STOP_OPEN;
+	cr_host_state.clear_ncpus = 1 + ncpus;
+	cr_host_state.clear_cpus_clearing = cr_host_state.clear_ncpus;
+	cr_host_state.clear_cpus_running = cr_host_state.clear_ncpus;
+}
+#endif /* defined(CONFIG_SMP) */
+
+/**
+ * cr_host_cpu_stop_all() - stop all CPUs with serialisation
+ *
+ * Initialise the per-CPU areas of all online CPUs according to the SMP
+ * clearing mode and stop all CPUs other than the calling CPU with a single
+ * IPI broadcast, waiting for each of them to record the TSC at arrival in
+ * its per-CPU area. If triggered in kernel context, CPUs are stopped with
+ * NMIs instead.
+ *
+ * Return: Nothing
+ */
+
+void cr_host_cpu_stop_all(void)
+{
+	int ncpu_this, ncpu;
+
+	ncpu_this = get_cpu();
+	cr_host_state.clear_cpu_boot = ncpu_this;
+	cr_host_state.clear_cpus_go = 0;
+	cr_host_state.clear_tsc_stop = cr_amd64_rdtsc();
+#if defined(CONFIG_SMP)
+	if (cr_host_state.host_trigger_state.triggered) {
+		crp_host_cpu_stop_all_nmi(ncpu_this);
+		return;
+	}
+#endif /* defined(CONFIG_SMP) */
+	cr_host_state.clear_ncpus = 0;
+	for_each_online_cpu(ncpu) {
+		crp_host_cpu_init_one(ncpu, ncpu_this);
+	}
+	cr_host_state.clear_cpus_clearing = cr_host_state.clear_ncpus;
+	cr_host_state.clear_cpus_running = cr_host_state.clear_ncpus;
+	CRHS_CPU_HOST(ncpu_this)->tsc_stopped = cr_host_state.clear_tsc_stop;
+#if defined(CONFIG_SMP)
+	cpumask_copy(&cr_host_state.host_cpu_stop_mask, cpu_online_mask);
+	cpumask_clear_cpu(ncpu_this, &cr_host_state.host_cpu_stop_mask);
+	smp_call_function_many(&cr_host_state.host_cpu_stop_mask,
+		crp_host_cpu_stop_one, NULL, 0);
+	for_each_cpu(ncpu, &cr_host_state.host_cpu_stop_mask) {
+		while (!__atomic_load_n(&CRHS_CPU_HOST(ncpu)->tsc_stopped, __ATOMIC_ACQUIRE)) {
+			__asm volatile("\tpause\n");
+		}
+	}
+#endif /* defined(CONFIG_SMP) */
+}
+
+/**
+ * cr_host_cpu_dry_run() - stop all CPUs and zero-fill the clear plan along the real clearing path
+ *
+ * Stop all online CPUs with stop_machine(), which has each of them record the
+ * TSC at arrival in and initialise its per-CPU area according to the SMP
+ * clearing mode. CPUs that take part in clearing switch to the map with
+ * cr_clear_cpu_enter() and return to the kernel once the chunk queues are
+ * drained, raising an NMI on themselves if any were taken in the map. The boot CPU is the first online CPU, as each CPU must agree on it
+ * without communicating; the caller must have set clear_dry_run and replaced
+ * the chunk queues.
+ *
+ * Return: Nothing
+ */
+
+static int crp_host_cpu_dry_run_one(void *data __attribute__((unused))) {
+	int ncpu, ncpu_boot, ncpus;
+	uint64_t tsc;
+
+	tsc = cr_amd64_rdtsc();
+	ncpu = smp_processor_id();
+	ncpu_boot = cpumask_first(cpu_online_mask);
+	CRC_INIT_CPU(CRHS_CPU_HOST(ncpu), ncpu, crp_host_cpu_nid(ncpu),
+		cr_host_cpu_clears(cr_host_state.clear_smp_mode, ncpu, ncpu_boot));
+	CRHS_CPU_HOST(ncpu)->tsc_stopped = tsc;
+	if (ncpu == ncpu_boot) {
+		for (ncpus = 0, ncpu = cpumask_first(cpu_online_mask);
+				ncpu < nr_cpu_ids; ncpu = cpumask_next(ncpu, cpu_online_mask)) {
+			ncpus += cr_host_cpu_clears(cr_host_state.clear_smp_mode, ncpu, ncpu_boot);
+		}
+		cr_host_state.clear_ncpus = ncpus;
+		cr_host_state.clear_cpus_clearing = ncpus;
+		cr_host_state.clear_cpus_running = ncpus;
+		__atomic_store_n(&cr_host_state.clear_cpu_boot, ncpu_boot, __ATOMIC_RELEASE);
+		ncpu = ncpu_boot;
+	}
+	if (CRHS_CPU_HOST(ncpu)->clear) {
+		kernel_fpu_begin();
+		cr_clear_cpu_enter(CRHS_CPU_HOST(ncpu), CRHS_CPU_MAP(ncpu), cr_clear_clear);
+		kernel_fpu_end();
+		if (CRHS_CPU_HOST(ncpu)->nnmis) {
+			apic->send_IPI_self(NMI_VECTOR);
+		}
+	}
+	return 0;
+}
+
+void cr_host_cpu_dry_run(void)
+{
+	cr_host_state.clear_cpu_boot = -1;
+	cr_host_state.clear_cpus_go = 0;
+	cr_clear_cpu_init();
+	cr_host_state.clear_tsc_stop = cr_amd64_rdtsc();
+	stop_machine(crp_host_cpu_dry_run_one, NULL, cpu_online_mask);
+}
+
+/**
+ * cr_host_flush{,_exit,_init}() - flush storage within time limit
+ *
+ * Queue one work item per active block device-backed superblock of each
+ * filesystem type in flush_fs on the unbound workqueue to write back and
+ * sync it in parallel, and wait for all of them to finish for at most
+ * flush_ms. Work items that have not finished by then are left running
+ * until the CPUs are stopped. The bytes of dirty and under writeback file
+ * pages left are recorded and reported. Filesystem types are resolved, and
+ * their modules pinned, at loading time, as resolving them may load modules.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static void crp_host_flush_work(struct work_struct *work) {
+	struct crh_flush_work *flush_work;
+	struct super_block *sb;
+
+	flush_work = container_of(work, struct crh_flush_work, work);
+	sb = flush_work->sb;
+	down_read(&sb->s_umount);
+	if (sb->s_root) {
+		sync_filesystem(sb);
+	}
+	up_read(&sb->s_umount);
+	deactivate_super(sb);
+	kfree(flush_work);
+	if (atomic_dec_and_test(&cr_host_state.host_flush.npending)) {
+		complete(&cr_host_state.host_flush.done);
+	}
+}
+
+static void crp_host_flush_sb(struct super_block *sb, void *arg) {
+	struct crh_flush_work *flush_work;
+	int *pnsbs = arg;
+
+	if (!sb->s_bdev) {
+		return;
+	} else
+	if (!(flush_work = kmalloc(sizeof(*flush_work), GFP_KERNEL))) {
+		return;
+	} else
+	if (!atomic_inc_not_zero(&sb->s_active)) {
+		kfree(flush_work);
+		return;
+	}
+	INIT_WORK(&flush_work->work, crp_host_flush_work);
+	flush_work->sb = sb;
+	atomic_inc(&cr_host_state.host_flush.npending);
+	queue_work(system_unbound_wq, &flush_work->work);
+	(*pnsbs)++;
+}
+
+void cr_host_flush(void)
+{
+	struct crh_flush_state *state;
+	size_t nfs_type;
+	long remaining;
+	int nsbs;
+
+	state = &cr_host_state.host_flush;
+	if (!cr_host_state.host_flush_ms) {
+		return;
+	}
+	init_completion(&state->done);
+	atomic_set(&state->npending, 1);
+	for (nfs_type = 0, nsbs = 0; nfs_type < state->nfs_types; nfs_type++) {
+		iterate_supers_type(state->fs_types[nfs_type], crp_host_flush_sb, &nsbs);
+	}
+	if (atomic_dec_and_test(&state->npending)) {
+		remaining = 1;
+	} else {
+		remaining = wait_for_completion_timeout(&state->done,
+			msecs_to_jiffies(cr_host_state.host_flush_ms));
+	}
+	cr_host_state.clear_flush_nbytes_dirty = (global_node_page_state(NR_FILE_DIRTY)
+		+ global_node_page_state(NR_WRITEBACK)) * PAGE_SIZE;
+	cr_host_state.clear_flushed = 1;
+	CRH_PRINTK_INFO("flushed %d filesystems%s, %zu bytes of dirty file pages left",
+		nsbs, remaining ? "" : " until timed out",
+		cr_host_state.clear_flush_nbytes_dirty);
+}
+
+void cr_host_flush_exit(void)
+{
+	struct crh_flush_state *state;
+
+	state = &cr_host_state.host_flush;
+	for (; state->nfs_types > 0; state->nfs_types--) {
+		module_put(state->fs_types[state->nfs_types - 1]->owner);
+	}
+}
+
+int cr_host_flush_init(void)
+{
+	struct crh_flush_state *state;
+	struct file_system_type *fs_type;
+	char name[32];
+	const char *p;
+	size_t nname;
+
+	state = &cr_host_state.host_flush;
+	if (!cr_host_state.host_flush_ms) {
+		return 0;
+	} else
+	if (!cr_host_state.host_flush_fs) {
+		cr_host_state.host_flush_fs = CRH_FLUSH_FS_DEFAULT;
+	}
+	for (p = cr_host_state.host_flush_fs; *p; p += (*p == ',')) {
+		for (nname = 0; *p && (*p != ','); p++) {
+			if (nname >= (sizeof(name) - 1)) {
+				return -EINVAL;
+			} else {
+				name[nname++] = *p;
+			}
+		}
+		name[nname] = '\0';
+		if (!nname) {
+			continue;
+		} else
+		if (state->nfs_types >= CRH_FLUSH_FS_MAX) {
+			CRH_PRINTK_ERR("more than %d filesystem types to flush", CRH_FLUSH_FS_MAX);
+			return -EINVAL;
+		} else
+		if (!(fs_type = get_fs_type(name))) {
+			CRH_PRINTK_INFO("not flushing unknown filesystem type %s", name);
+		} else {
+			state->fs_types[state->nfs_types++] = fs_type;
+		}
+	}
+	CRH_PRINTK_INFO("flushing %zu filesystem types for at most %lu ms before clearing",
+		state->nfs_types, cr_host_state.host_flush_ms);
+	return 0;
+}
+
+/**
+ * cr_host_heartbeat_{arm,disarm,exit,init}() - dead-man switch heartbeat
+ * @timeout_ms:	time in ms within which the heartbeat counter must advance
+ *
+ * The heartbeat page holds a struct cr_ioc_heartbeat_page, mapped into
+ * userland through cr_host_cdev_mmap(), whose counter is advanced by a
+ * supervisor process without issuing any system calls. Once armed, an
+ * hrtimer samples the counter CRH_HEARTBEAT_NCHECKS times per timeout and
+ * triggers clearing through cr_host_trigger() from hardirq context if it
+ * has not advanced within timeout_ms. Closing /dev/clearram does not disarm
+ * the heartbeat, as the supervisor dying is what it is meant to detect.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static enum hrtimer_restart crp_host_heartbeat_timer(struct hrtimer *timer __attribute__((unused))) {
+	struct crh_heartbeat_state *state;
+	uint64_t counter;
+	ktime_t now;
+
+	state = &cr_host_state.host_heartbeat;
+	counter = READ_ONCE(((struct cr_ioc_heartbeat_page *)page_address(state->page))->counter);
+	now = ktime_get();
+	if (counter != state->counter_last) {
+		state->counter_last = counter;
+		state->ktime_last = now;
+	} else
+	if (ktime_after(now, ktime_add(state->ktime_last, state->timeout))) {
+		CRH_PRINTK_ERR("heartbeat missed for %lld ms",
+			ktime_ms_delta(now, state->ktime_last));
+		cr_host_trigger();
+		return HRTIMER_NORESTART;
+	}
+	hrtimer_forward_now(&state->timer, state->period);
+	return HRTIMER_RESTART;
+}
+
+int cr_host_heartbeat_arm(unsigned long timeout_ms)
+{
+	struct crh_heartbeat_state *state;
+
+	state = &cr_host_state.host_heartbeat;
+	if (!state->page) {
+		return -ENODEV;
+	} else
+	if (timeout_ms < CRH_HEARTBEAT_TIMEOUT_MIN_MS) {
+		return -EINVAL;
+	}
+	mutex_lock(&state->mutex);
+	hrtimer_cancel(&state->timer);
+	state->timeout = ms_to_ktime(timeout_ms);
+	state->period = ms_to_ktime(timeout_ms / CRH_HEARTBEAT_NCHECKS);
+	state->counter_last = READ_ONCE(((struct cr_ioc_heartbeat_page *)
+		page_address(state->page))->counter);
+	state->ktime_last = ktime_get();
+	hrtimer_start(&state->timer, state->period, HRTIMER_MODE_REL);
+	mutex_unlock(&state->mutex);
+	CRH_PRINTK_INFO("heartbeat armed with a timeout of %lu ms", timeout_ms);
+	return 0;
+}
+
+void cr_host_heartbeat_disarm(void)
+{
+	struct crh_heartbeat_state *state;
+
+	state = &cr_host_state.host_heartbeat;
+	if (!state->page) {
+		return;
+	}
+	mutex_lock(&state->mutex);
+	if (hrtimer_cancel(&state->timer)) {
+		CRH_PRINTK_INFO("heartbeat disarmed");
+	}
+	mutex_unlock(&state->mutex);
+}
+
+void cr_host_heartbeat_exit(void)
+{
+	struct crh_heartbeat_state *state;
+
+	state = &cr_host_state.host_heartbeat;
+	if (state->page) {
+		hrtimer_cancel(&state->timer);
+		__free_page(state->page);
+		state->page = NULL;
+	}
+}
+
+int cr_host_heartbeat_init(void)
+{
+	struct crh_heartbeat_state *state;
+
+	state = &cr_host_state.host_heartbeat;
+	mutex_init(&state->mutex);
+	hrtimer_init(&state->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	state->timer.function = crp_host_heartbeat_timer;
+	if (!(state->page = alloc_page(GFP_KERNEL | __GFP_ZERO))) {
+		return -ENOMEM;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * cr_host_hints_{exit,init}() - prioritise slab and active anonymous pages in the background
+ *
+ * Every CRH_HINTS_INTERVAL_MS, raise each 2 MB region of RAM holding slab
+ * pages, which back e.g. keyring payloads and dm-crypt keys, or active
+ * anonymous LRU pages to CRC_PRIORITY_SLAB or CRC_PRIORITY_ANON,
+ * respectively, in the clear plan, so that triggers merely use the
+ * priorities found so far. Pages are classified without holding the plan
+ * mutex, rescheduling after each region, and the runs found are applied
+ * and the clear plan sorted at once while holding it. 2 MB matches the
+ * pageblock size the page allocator groups unmovable allocations by and
+ * keeps the clear plan from fragmenting; hints are dropped once the clear
+ * plan is full, and priorities are never lowered again.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static int crp_host_hints_class(uintptr_t pfn_base) {
+	int priority;
+	struct page *page;
+	uintptr_t pfn;
+
+	for (pfn = pfn_base, priority = CRC_PRIORITY_BULK;
+			pfn < (pfn_base + CRA_PS_2M); pfn++) {
+		if (!pfn_valid(pfn)) {
+			continue;
+		} else
+		if (PageSlab((page = pfn_to_page(pfn)))) {
+			return CRC_PRIORITY_SLAB;
+		} else
+		if (PageAnon(page) && PageActive(page)) {
+			priority = CRC_PRIORITY_ANON;
+		}
+	}
+	return priority;
+}
+
+static void crp_host_hints_append(struct crh_hints_state *state, uintptr_t pfn, size_t npages, int priority) {
+	if (state->nruns < CRHS_PLAN_NENTS) {
+		state->runs[state->nruns].pfn = pfn;
+		state->runs[state->nruns].npages = npages;
+		state->runs[state->nruns++].priority = priority;
+	}
+}
+
+static void crp_host_hints_work(struct work_struct *work __attribute__((unused))) {
+	struct crh_hints_state *state;
+	struct crc_plan_ent *ent;
+	size_t nent, nrun;
+	uintptr_t pfn, pfn_base, pfn_limit, pfn_run;
+	int priority, priority_run;
+
+	state = &cr_host_state.host_hints_state;
+	mutex_lock(&crp_host_plan_mutex);
+	for (nent = 0, pfn_base = -1, pfn_limit = 0;
+			nent < cr_host_state.clear_nplan; nent++) {
+		ent = CRHS_PLAN_HOST(nent);
+		if (ent->pfn < pfn_base) {
+			pfn_base = ent->pfn;
+		}
+		if ((ent->pfn + (ent->nbytes / PAGE_SIZE)) > pfn_limit) {
+			pfn_limit = ent->pfn + (ent->nbytes / PAGE_SIZE);
+		}
+	}
+	mutex_unlock(&crp_host_plan_mutex);
+	pfn_base &= ~(CRA_PS_2M - 1);
+	for (pfn = pfn_run = pfn_base, priority_run = CRC_PRIORITY_BULK, state->nruns = 0;
+			pfn < pfn_limit; pfn += CRA_PS_2M) {
+		if (__atomic_load_n(&cr_host_state.host_triggered, __ATOMIC_RELAXED)) {
+			return;
+		} else
+		if ((priority = crp_host_hints_class(pfn)) != priority_run) {
+			if (priority_run != CRC_PRIORITY_BULK) {
+				crp_host_hints_append(state, pfn_run, pfn - pfn_run, priority_run);
+			}
+			pfn_run = pfn, priority_run = priority;
+		}
+		cond_resched();
+	}
+	if (priority_run != CRC_PRIORITY_BULK) {
+		crp_host_hints_append(state, pfn_run, pfn - pfn_run, priority_run);
+	}
+	mutex_lock(&crp_host_plan_mutex);
+	if (!__atomic_load_n(&cr_host_state.host_triggered, __ATOMIC_RELAXED)) {
+		for (nrun = 0; (nrun < state->nruns) && (cr_host_lkm_plan_prioritise(
+				state->runs[nrun].pfn, state->runs[nrun].npages,
+				state->runs[nrun].priority) == 0); nrun++) {
+		}
+		cr_host_lkm_plan_sort();
+	}
+	mutex_unlock(&crp_host_plan_mutex);
+	queue_delayed_work(system_long_wq, &state->work,
+		msecs_to_jiffies(CRH_HINTS_INTERVAL_MS));
+}
+
+void cr_host_hints_exit(void)
+{
+	struct crh_hints_state *state;
+
+	state = &cr_host_state.host_hints_state;
+	if (state->work_queued) {
+		cancel_delayed_work_sync(&state->work);
+		state->work_queued = 0;
+	}
+	if (state->runs) {
+		vfree(state->runs);
+		state->runs = NULL;
+	}
+}
+
+int cr_host_hints_init(void)
+{
+	struct crh_hints_state *state;
+
+	state = &cr_host_state.host_hints_state;
+	if (!cr_host_state.host_hints) {
+		return 0;
+	} else
+	if (!(state->runs = vmalloc(CRHS_PLAN_NENTS * sizeof(*state->runs)))) {
+		return -ENOMEM;
+	}
+	INIT_DELAYED_WORK(&state->work, crp_host_hints_work);
+	queue_delayed_work(system_long_wq, &state->work, 0);
+	state->work_queued = 1;
+	return 0;
+}
+
+/**
+ * cr_host_lkm_exit() - kernel module exit point
+ *
+ * Return: Nothing
+ */
+
+void cr_host_lkm_exit(void)
+{
+	cr_host_heartbeat_exit();
+	cr_host_hints_exit();
+	cr_host_flush_exit();
+	cr_host_pci_exit();
+	cr_host_trigger_exit();
+	cr_host_prezero_exit();
+	cr_host_telemetry_exit();
+	if (cr_host_state.host_cdev_device) {
+		device_destroy(cr_host_state.host_cdev_class,
+			MKDEV(cr_host_state.host_cdev_major, 0));
+	}
+	if (cr_host_state.host_cdev_class) {
+		class_destroy(cr_host_state.host_cdev_class);
+	}
+	if (cr_host_state.host_cdev_major) {
+		unregister_chrdev(cr_host_state.host_cdev_major, "clearram");
+	}
+	cr_host_map_free(cr_host_state.clear_pml4, cr_host_vmfree);
+	if (cr_host_state.host_cpu_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_cpu_va_base);
+	}
+	if (cr_host_state.host_plan_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_plan_va_base);
+	}
+	if (cr_host_state.host_skip_va_base) {
+		cr_host_vmfree((void *)cr_host_state.host_skip_va_base);
+	}
+}
+
+/**
+ * cr_host_pci_{exit,init,quiesce}() - disable bus mastering on all PCI functions
+ *
+ * Snapshot the bus and devfn of every PCI function on segment 0 at loading
+ * time and of every function added later from a bus notifier, both in
+ * process context. Once all other CPUs have been stopped, clear the Bus
+ * Master Enable bit in the command register of every snapshotted function
+ * that has it set, stopping DMA into RAM that is being or has been cleared,
+ * and record each function in the clearing state. As the other CPUs may
+ * have been stopped holding the PCI device list lock or pci_lock, neither
+ * is taken; configuration space is accessed directly through configuration
+ * mechanism #1 at ports 0xcf8 and 0xcfc as by cr_amd64_reset() instead,
+ * which reaches segment 0 only. Functions on other segments, or beyond
+ * CRH_PCI_FNS_MAX, are counted and reported at loading time.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static void crp_host_pci_add(struct pci_dev *pdev) {
+	struct crh_pci_state *state;
+	size_t nfn;
+	uint16_t fn;
+
+	state = &cr_host_state.host_pci;
+	fn = (pdev->bus->number << 8) | pdev->devfn;
+	for (nfn = 0; nfn < state->nfns; nfn++) {
+		if (state->fns[nfn] == fn) {
+			return;
+		}
+	}
+	if ((pci_domain_nr(pdev->bus) != 0) || (state->nfns >= CRH_PCI_FNS_MAX)) {
+		state->nfns_skipped++;
+	} else {
+		state->fns[state->nfns] = fn;
+		__atomic_store_n(&state->nfns, state->nfns + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static int crp_host_pci_notify(struct notifier_block *nb __attribute__((unused)), unsigned long action, void *data) {
+	if (action == BUS_NOTIFY_ADD_DEVICE) {
+		mutex_lock(&cr_host_state.host_pci.mutex);
+		crp_host_pci_add(to_pci_dev(data));
+		mutex_unlock(&cr_host_state.host_pci.mutex);
+	}
+	return NOTIFY_DONE;
+}
+
+void cr_host_pci_exit(void)
+{
+	struct crh_pci_state *state;
+
+	state = &cr_host_state.host_pci;
+	if (state->nb_registered) {
+		bus_unregister_notifier(&pci_bus_type, &state->nb);
+		state->nb_registered = 0;
+	}
+}
+
+int cr_host_pci_init(void)
+{
+	struct crh_pci_state *state;
+	struct pci_dev *pdev;
+	int err;
+
+	state = &cr_host_state.host_pci;
+	mutex_init(&state->mutex);
+	if (!cr_host_state.host_quiesce_pci) {
+		return 0;
+	}
+	state->nb.notifier_call = crp_host_pci_notify;
+	if ((err = bus_register_notifier(&pci_bus_type, &state->nb)) < 0) {
+		return err;
+	} else {
+		state->nb_registered = 1;
+	}
+	mutex_lock(&state->mutex);
+	pdev = NULL;
+	for_each_pci_dev(pdev) {
+		crp_host_pci_add(pdev);
+	}
+	mutex_unlock(&state->mutex);
+	if (state->nfns_skipped) {
+		CRH_PRINTK_INFO("not quiescing %zu PCI functions beyond segment 0 or the first %d",
+			state->nfns_skipped, CRH_PCI_FNS_MAX);
+	}
+	return 0;
+}
+
+void cr_host_pci_quiesce(void)
+{
+	struct crh_pci_state *state;
+	size_t nfn, nfns;
+	uint16_t command;
+
+	state = &cr_host_state.host_pci;
+	if (!cr_host_state.host_quiesce_pci) {
+		return;
+	}
+	for (nfn = 0, nfns = __atomic_load_n(&state->nfns, __ATOMIC_ACQUIRE);
+			nfn < nfns; nfn++) {
+		cr_amd64_outl(0xcf8, 0x80000000 | (state->fns[nfn] << 8) | (PCI_COMMAND & 0xfc));
+		command = cr_amd64_inw(0xcfc + (PCI_COMMAND & 0x03));
+		if ((command == 0xffff) || !(command & PCI_COMMAND_MASTER)) {
+			continue;
+		}
+		cr_amd64_outl(0xcf8, 0x80000000 | (state->fns[nfn] << 8) | (PCI_COMMAND & 0xfc));
+		cr_amd64_outw(0xcfc + (PCI_COMMAND & 0x03), command & ~PCI_COMMAND_MASTER);
+		if (cr_host_state.clear_npci_fns < CRC_PCI_FNS_MAX) {
+			cr_host_state.clear_pci_fns[cr_host_state.clear_npci_fns] = state->fns[nfn];
+		}
+		cr_host_state.clear_npci_fns++;
+	}
+	cr_host_state.clear_pci_quiesced = 1;
+}
+
+/**
+ * cr_host_pmap_node() - get NUMA node of physical address (PFN) range
+ * @pfn_base:		base physical address (PFN) of range
+ * @pfn_limit:		physical address limit (PFN) of range
+ * @ppfn_node_limit:	pointer to limit address (PFN) of the part of the
+ *			range local to the same node as pfn_base
+ *
+ * Return: NUMA node of pfn_base, 0 if unknown
+ */
+
+int cr_host_pmap_node(uintptr_t pfn_base, uintptr_t pfn_limit, uintptr_t *ppfn_node_limit)
+{
+#if defined(CONFIG_NUMA)
+	int nid, nid_base;
+
+	nid_base = pfn_valid(pfn_base) ? pfn_to_nid(pfn_base) : 0;
+	if ((nid_base < 0) || (nid_base >= CRHS_NODES_MAX)) {
+		nid_base = 0;
+	}
+	*ppfn_node_limit = pfn_limit;
+	for_each_online_node(nid) {
+		if ((node_start_pfn(nid) > pfn_base)
+		&&  (node_start_pfn(nid) < *ppfn_node_limit)) {
+			*ppfn_node_limit = node_start_pfn(nid);
+		}
+		if ((node_end_pfn(nid) > pfn_base)
+		&&  (node_end_pfn(nid) < *ppfn_node_limit)) {
+			*ppfn_node_limit = node_end_pfn(nid);
+		}
+	}
+	return nid_base;
+#else
+	*ppfn_node_limit = pfn_limit;
+	return 0;
+#endif /* defined(CONFIG_NUMA) */
+}
+
+/**
+ * cr_host_prezero_{exit,init,seal}() - zero and hold free RAM in the background
+ *
+ * With prezero_mb set, a kernel thread at the lowest priority allocates
+ * free RAM in blocks of CRH_PREZERO_ORDER without entering reclaim, zeroes
+ * them with the zero-filling kernel at no more than prezero_mbps, and holds
+ * them until the module is unloaded. As no one else can write to them, they
+ * remain zero and are marked in the skip bitmap at trigger time once the
+ * thread and the shrinker have been stopped. The blocks are given back to
+ * the page allocator by a shrinker under memory pressure, after which
+ * allocating resumes no sooner than CRH_PREZERO_BACKOFF_MS later.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+static void crp_host_prezero_free(size_t nblocks) {
+	struct crh_prezero_state *state;
+	struct page *page;
+	size_t nblock;
+
+	state = &cr_host_state.host_prezero;
+	for (nblock = 0; nblock < nblocks; nblock++) {
+		spin_lock(&state->lock);
+		if (list_empty(&state->blocks)) {
+			spin_unlock(&state->lock);
+			break;
+		} else {
+			page = list_first_entry(&state->blocks, struct page, lru);
+			list_del(&page->lru);
+			state->nblocks--;
+			spin_unlock(&state->lock);
+		}
+		__free_pages(page, CRH_PREZERO_ORDER);
+	}
+}
+
+static unsigned long crp_host_prezero_count(struct shrinker *shrinker __attribute__((unused)), struct shrink_control *sc __attribute__((unused))) {
+	return cr_host_state.host_prezero.nblocks << CRH_PREZERO_ORDER;
+}
+
+static unsigned long crp_host_prezero_scan(struct shrinker *shrinker __attribute__((unused)), struct shrink_control *sc) {
+	struct crh_prezero_state *state;
+	size_t nblocks;
+
+	state = &cr_host_state.host_prezero;
+	state->jiffies_shrunk = jiffies;
+	nblocks = state->nblocks;
+	crp_host_prezero_free((sc->nr_to_scan + (1 << CRH_PREZERO_ORDER) - 1) >> CRH_PREZERO_ORDER);
+	return (nblocks - state->nblocks) << CRH_PREZERO_ORDER;
+}
+
+static int crp_host_prezero_thread(void *arg __attribute__((unused))) {
+	struct crh_prezero_state *state;
+	struct page *page;
+	size_t nbytes, nblocks_max;
+	unsigned long ms;
+
+	state = &cr_host_state.host_prezero;
+	nbytes = PAGE_SIZE << CRH_PREZERO_ORDER;
+	nblocks_max = (cr_host_state.host_prezero_mb * 1024 * 1024) / nbytes;
+	ms = (nbytes * 1000) / (cr_host_state.host_prezero_mbps * 1024 * 1024);
+	set_user_nice(current, MAX_NICE);
+	while (!kthread_should_stop()) {
+		if ((state->nblocks >= nblocks_max)
+		||  (state->jiffies_shrunk && time_before(jiffies, state->jiffies_shrunk
+				+ msecs_to_jiffies(CRH_PREZERO_BACKOFF_MS)))
+		||  !(page = alloc_pages(GFP_NOWAIT | __GFP_NOWARN, CRH_PREZERO_ORDER))) {
+			msleep_interruptible(CRH_PREZERO_IDLE_MS);
+			continue;
+		}
+		kernel_fpu_begin();
+		cr_amd64_clear(cr_host_state.clear_kernel,
+			(uintptr_t)page_address(page), nbytes);
+		kernel_fpu_end();
+		spin_lock(&state->lock);
+		list_add_tail(&page->lru, &state->blocks);
+		state->nblocks++;
+		spin_unlock(&state->lock);
+		msleep_interruptible(ms ? ms : 1);
+	}
+	return 0;
+}
+
+static void crp_host_prezero_stop(struct crh_prezero_state *state) {
+	if (state->thread) {
+		kthread_stop(state->thread);
+		state->thread = NULL;
+	}
+	if (state->shrinker_registered) {
+		unregister_shrinker(&state->shrinker);
+		state->shrinker_registered = 0;
+	}
+}
+
+void cr_host_prezero_exit(void)
+{
+	crp_host_prezero_stop(&cr_host_state.host_prezero);
+	if (cr_host_state.host_prezero.blocks.next) {
+		crp_host_prezero_free(cr_host_state.host_prezero.nblocks);
+	}
+}
+
+int cr_host_prezero_init(void)
+{
+	struct crh_prezero_state *state;
+	int err;
+
+	state = &cr_host_state.host_prezero;
+	spin_lock_init(&state->lock);
+	INIT_LIST_HEAD(&state->blocks);
+	if (!cr_host_state.host_prezero_mb) {
+		return 0;
+	} else
+	if (!cr_host_state.host_prezero_mbps) {
+		CRH_PRINTK_ERR("pre-zeroing rate limit must not be 0");
+		return -EINVAL;
+	}
+	state->shrinker.count_objects = crp_host_prezero_count;
+	state->shrinker.scan_objects = crp_host_prezero_scan;
+	state->shrinker.seeks = DEFAULT_SEEKS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	err = register_shrinker(&state->shrinker, "clearram-prezero");
+#else
+	err = register_shrinker(&state->shrinker);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0) */
+	if (err < 0) {
+		return err;
+	} else {
+		state->shrinker_registered = 1;
+	}
+	state->thread = kthread_run(crp_host_prezero_thread, NULL, "clearram-prezero");
+	if (IS_ERR(state->thread)) {
+		err = PTR_ERR(state->thread);
+		state->thread = NULL;
+		return err;
+	} else {
+		CRH_PRINTK_INFO("pre-zeroing up to %lu MB of free RAM at %lu MB/s",
+			cr_host_state.host_prezero_mb, cr_host_state.host_prezero_mbps);
+		return 0;
+	}
+}
+
+void cr_host_prezero_seal(void)
+{
+	struct crh_prezero_state *state;
+	struct crc_plan_ent *ent;
+	struct page *page;
+	size_t nent, npage;
+	uintptr_t pfn, va;
+
+	state = &cr_host_state.host_prezero;
+	crp_host_prezero_stop(state);
+	if (!state->blocks.next) {
+		return;
+	}
+	ent = NULL;
+	list_for_each_entry(page, &state->blocks, lru) {
+		for (npage = 0, pfn = page_to_pfn(page);
+				npage < (1 << CRH_PREZERO_ORDER); npage++, pfn++) {
+			if (!ent || (pfn < ent->pfn)
+			||  (pfn >= (ent->pfn + (ent->nbytes / PAGE_SIZE)))) {
+				for (nent = 0, ent = NULL; !ent
+						&& (nent < cr_host_state.clear_nplan); nent++) {
+					ent = CRHS_PLAN_HOST(nent);
+					if ((pfn < ent->pfn)
+					||  (pfn >= (ent->pfn + (ent->nbytes / PAGE_SIZE)))) {
+						ent = NULL;
+					}
+				}
+			}
+			if (ent) {
+				va = ent->va + ((pfn - ent->pfn) * PAGE_SIZE);
+				*CRHS_SKIP_HOST(va) |= CRHS_SKIP_BIT(va);
+			}
+		}
+	}
+}
+
+/**
+ * cr_host_reset_acpi() - get ACPI FADT reset register
+ * @reset:	pointer to reset method to fill in the reset register of
+ *
+ * Return: 0 on success, <0 if there is no reset register or if it is
+ * neither in system I/O nor in PCI configuration space
+ */
+
+int cr_host_reset_acpi(struct cra_reset *reset)
+{
+	int err;
+	struct acpi_table_header *hdr;
+	struct acpi_table_fadt *fadt;
+
+	if (acpi_disabled
+	||  ACPI_FAILURE(acpi_get_table(ACPI_SIG_FADT, 0, &hdr))) {
+		return -ENODEV;
+	}
+	fadt = (struct acpi_table_fadt *)hdr;
+	if (!(fadt->flags & ACPI_FADT_RESET_REGISTER)) {
+		err = -ENODEV;
+	} else
+	if ((fadt->reset_register.space_id != ACPI_ADR_SPACE_SYSTEM_IO)
+	&&  (fadt->reset_register.space_id != ACPI_ADR_SPACE_PCI_CONFIG)) {
+		err = -EOPNOTSUPP;
+	} else {
+		reset->acpi_space =
+			(fadt->reset_register.space_id == ACPI_ADR_SPACE_SYSTEM_IO)
+			? CRA_RESET_SPACE_IO : CRA_RESET_SPACE_PCI;
+		reset->acpi_address = fadt->reset_register.address;
+		reset->acpi_value = fadt->reset_value;
+		err = 0;
+	}
+	acpi_put_table(hdr);
+	return err;
+}
+
+/**
+ * cr_host_telemetry_{exit,init}() - read back telemetry record of previous clearing
+ *
+ * The telemetry record page at telemetry_addr must have been reserved, e.g.
+ * with memmap=4K$<telemetry_addr>, so that it is excluded from the clear
+ * plan and left alone by the kernel across resets, which cr_host_lkm_init()
+ * enforces when mapping it. If the record found there at load time is
+ * valid, it is copied, invalidated so that it is reported only once, and
+ * exposed through debugfs at clearram/telemetry.
+ *
+ * Return: 0 on success, <0 on failure
+ */
+
+void cr_host_telemetry_exit(void)
+{
+	struct crh_telemetry_state *state;
+
+	state = &cr_host_state.host_telemetry;
+	debugfs_remove_recursive(state->dir);
+	state->dir = NULL;
+	kfree(state->record);
+	state->record = NULL;
+}
+
+int cr_host_telemetry_init(void)
+{
+	struct crh_telemetry_state *state;
+	struct cr_telemetry *record;
+
+	state = &cr_host_state.host_telemetry;
+	if (!cr_host_state.clear_telemetry_addr) {
+		return 0;
+	} else
+	if (!(record = memremap(cr_host_state.clear_telemetry_addr,
+			PAGE_SIZE, MEMREMAP_WB))) {
+		return -ENOMEM;
+	}
+	if ((record->magic == CR_TELEMETRY_MAGIC)
+	&&  (record->version == CR_TELEMETRY_VERSION)
+	&&  (state->record = kmemdup(record, sizeof(*record), GFP_KERNEL))) {
+		record->magic = 0;
+	}
+	memunmap(record);
+	if (!state->record) {
+		return 0;
+	}
+	CRH_PRINTK_INFO("telemetry record of previous clearing found, state %u",
+		state->record->state);
+	state->blob.data = state->record;
+	state->blob.size = sizeof(*state->record);
+	state->dir = debugfs_create_dir("clearram", NULL);
+	debugfs_create_blob("telemetry", 0400, state->dir, &state->blob);
+	return 0;
+}
+
+/**
+ * cr_host_trigger{,_exit,_init}() - trigger clearing in kernel context and register and unregister in-kernel triggers
+ *
+ * Clear RAM from the panic notifier chain ahead of all other notifiers if
+ * panic is set and, if set to 2, from the die notifier chain on oops, upon
+ * presses of any key or setting of any switch in trigger_keys or trigger_sws
+ * on any input device, upon removal of any USB device in trigger_usb, and, if
+ * trigger_acpi is set, upon presses of ACPI power button devices, which are
+ * otherwise reported as KEY_POWER by the ACPI button driver, as are fixed
+ * hardware power buttons. Triggers call cr_host_trigger() straight from the
+ * context they are notified in, possibly atomic, which does nothing that may
+ * sleep or take locks held by other CPUs: free RAM pre-zeroed in the
+ * background is cleared again and hints found so far are used as they
+ * are. The other CPUs are
+ * stopped with NMIs by cr_host_cpu_stop_all(), which reach CPUs already
+ * stopped in panic context; their NMI handler is registered regardless of
+ * the triggers enabled, as the heartbeat may be armed at any time. The TSC
+ * at the time of the trigger is recorded to report the latency until
+ * clearing starts.
+ *
+ * Return: Nothing if triggered first, 0 on success or <0 on failure otherwise
+ */
+static int crp_host_trigger_panic(struct notifier_block *nb __attribute__((unused)), unsigned long action __attribute__((unused)), void *data __attribute__((unused))) {
+	cr_host_trigger();
+	return NOTIFY_DONE;
+}
+
+static int crp_host_trigger_die(struct notifier_block *nb __attribute__((unused)), unsigned long val, void *data __attribute__((unused))) {
+	if (val == DIE_OOPS) {
+		cr_host_trigger();
+	}
+	return NOTIFY_DONE;
+}
+
+static int crp_host_trigger_input_codes(unsigned int type, int **pcodes) {
+	switch (type) {
+	case EV_KEY:
+		*pcodes = cr_host_state.host_trigger_keys;
+		return cr_host_state.host_trigger_nkeys;
+	case EV_SW:
+		*pcodes = cr_host_state.host_trigger_sws;
+		return cr_host_state.host_trigger_nsws;
+	default:
+		return 0;
+	}
+}
+
+static void crp_host_trigger_input_event(struct input_handle *handle __attribute__((unused)), unsigned int type, unsigned int code, int value) {
+	int *codes, ncode, ncodes;
+
+	if (value) {
+		for (ncode = 0, ncodes = crp_host_trigger_input_codes(type, &codes);
+				ncode < ncodes; ncode++) {
+			if (codes[ncode] == code) {
+				cr_host_trigger();
+			}
+		}
+	}
+}
+
+static bool crp_host_trigger_input_match(struct input_handler *handler __attribute__((unused)), struct input_dev *dev) {
+	unsigned ncode;
+
+	for (ncode = 0; ncode < cr_host_state.host_trigger_nkeys; ncode++) {
+		if ((cr_host_state.host_trigger_keys[ncode] >= 0)
+		&&  (cr_host_state.host_trigger_keys[ncode] <= KEY_MAX)
+		&&  test_bit(cr_host_state.host_trigger_keys[ncode], dev->keybit)) {
+			return true;
+		}
+	}
+	for (ncode = 0; ncode < cr_host_state.host_trigger_nsws; ncode++) {
+		if ((cr_host_state.host_trigger_sws[ncode] >= 0)
+		&&  (cr_host_state.host_trigger_sws[ncode] <= SW_MAX)
+		&&  test_bit(cr_host_state.host_trigger_sws[ncode], dev->swbit)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int crp_host_trigger_input_connect(struct input_handler *handler, struct input_dev *dev, const struct input_device_id *id __attribute__((unused))) {
+	struct input_handle *handle;
+	int err;
+
+	if (!(handle = kzalloc(sizeof(*handle), GFP_KERNEL))) {
+		return -ENOMEM;
+	}
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "clearram";
+	if ((err = input_register_handle(handle)) < 0) {
+		kfree(handle);
+		return err;
+	} else
+	if ((err = input_open_device(handle)) < 0) {
+		input_unregister_handle(handle);
+		kfree(handle);
+		return err;
+	} else {
+		CRH_PRINTK_INFO("triggering on input device %s", dev->name);
+		return 0;
+	}
+}
+
+static void crp_host_trigger_input_disconnect(struct input_handle *handle) {
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id crp_host_trigger_input_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_SW) },
+	},
+	{ },
+};
+
+static int crp_host_trigger_usb(struct notifier_block *nb __attribute__((unused)), unsigned long action, void *data) {
+	struct crh_trigger_usb *usb;
+	struct usb_device *udev;
+	size_t nusb;
+
+	if (action != USB_DEVICE_REMOVE) {
+		return NOTIFY_DONE;
+	}
+	udev = data;
+	for (nusb = 0; nusb < cr_host_state.host_trigger_state.nusb; nusb++) {
+		usb = &cr_host_state.host_trigger_state.usb[nusb];
+		if ((le16_to_cpu(udev->descriptor.idVendor) == usb->vid)
+		&&  (le16_to_cpu(udev->descriptor.idProduct) == usb->pid)
+		&&  (!usb->serial[0] || (udev->serial && !strcmp(udev->serial, usb->serial)))) {
+			cr_host_trigger();
+		}
+	}
+	return NOTIFY_DONE;
+}
+
+static int crp_host_trigger_usb_parse(struct crh_trigger_state *state, const char *str) {
+	const char *p;
+	size_t nserial;
+
+	for (p = str, state->nusb = 0; *p;) {
+		if (state->nusb >= CRH_TRIGGER_USB_MAX) {
+			return -EINVAL;
+		} else
+		if (sscanf(p, "%hx:%hx", &state->usb[state->nusb].vid,
+				&state->usb[state->nusb].pid) != 2) {
+			return -EINVAL;
+		}
+		for (; *p && (*p != ':'); p++) {
+		}
+		for (p += (*p == ':'); *p && (*p != ':') && (*p != ','); p++) {
+		}
+		nserial = 0;
+		if (*p == ':') {
+			for (p++; *p && (*p != ','); p++) {
+				if (nserial >= (sizeof(state->usb[0].serial) - 1)) {
+					return -EINVAL;
+				} else {
+					state->usb[state->nusb].serial[nserial++] = *p;
+				}
+			}
+		}
+		state->usb[state->nusb++].serial[nserial] = '\0';
+		p += (*p == ',');
+	}
+	return 0;
+}
+
+static void crp_host_trigger_acpi(acpi_handle handle __attribute__((unused)), u32 event, void *context __attribute__((unused))) {
+	if (event == CRH_TRIGGER_ACPI_NOTIFY) {
+		cr_host_trigger();
+	}
+}
+
+static acpi_status crp_host_trigger_acpi_add(acpi_handle handle, u32 level __attribute__((unused)), void *context __attribute__((unused)), void **retval __attribute__((unused))) {
+	struct crh_trigger_state *state;
+
+	state = &cr_host_state.host_trigger_state;
+	if (state->nacpi_handles >= CRH_TRIGGER_ACPI_MAX) {
+		return AE_CTRL_TERMINATE;
+	} else
+	if (ACPI_SUCCESS(acpi_install_notify_handler(handle, ACPI_DEVICE_NOTIFY,
+			crp_host_trigger_acpi, NULL))) {
+		state->acpi_handles[state->nacpi_handles++] = handle;
+	}
+	return AE_OK;
+}
+
+void cr_host_trigger(void)
+{
+	if (__atomic_exchange_n(&cr_host_state.host_triggered, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	} else {
+		cr_host_state.clear_tsc_trigger = cr_amd64_rdtsc();
+		cr_host_state.host_trigger_state.triggered = 1;
+	}
+	local_irq_disable();
+	cr_clear_cpu_entry();
+	__builtin_unreachable();
+}
+
+void cr_host_trigger_exit(void)
+{
+	struct crh_trigger_state *state;
+
+	state = &cr_host_state.host_trigger_state;
+	for (; state->nacpi_handles > 0; state->nacpi_handles--) {
+		acpi_remove_notify_handler(state->acpi_handles[state->nacpi_handles - 1],
+			ACPI_DEVICE_NOTIFY, crp_host_trigger_acpi);
+	}
+	if (state->usb_registered) {
+		usb_unregister_notify(&state->usb_nb);
+		state->usb_registered = 0;
+	}
+	if (state->input_registered) {
+		input_unregister_handler(&state->input_handler);
+		state->input_registered = 0;
+	}
+	if (state->die_registered) {
+		unregister_die_notifier(&state->die_nb);
+		state->die_registered = 0;
+	}
+	if (state->panic_registered) {
+		atomic_notifier_chain_unregister(&panic_notifier_list, &state->panic_nb);
+		state->panic_registered = 0;
+	}
+#if defined(CONFIG_SMP)
+	if (state->nmi_registered) {
+		unregister_nmi_handler(NMI_LOCAL, "clearram");
+		state->nmi_registered = 0;
+	}
+#endif /* defined(CONFIG_SMP) */
+}
+
+int cr_host_trigger_init(void)
+{
+	struct crh_trigger_state *state;
+	int err;
+
+	state = &cr_host_state.host_trigger_state;
+	if ((cr_host_state.host_panic < 0) || (cr_host_state.host_panic > 2)) {
+		CRH_PRINTK_ERR("invalid panic trigger mode %d", cr_host_state.host_panic);
+		return -EINVAL;
+	} else
+	if (cr_host_state.host_trigger_usb
+	&&  ((err = crp_host_trigger_usb_parse(state, cr_host_state.host_trigger_usb)) < 0)) {
+		CRH_PRINTK_ERR("invalid USB devices %s", cr_host_state.host_trigger_usb);
+		return err;
+	}
+#if defined(CONFIG_SMP)
+	if ((err = register_nmi_handler(NMI_LOCAL, crp_host_cpu_stop_nmi,
+			NMI_FLAG_FIRST, "clearram")) < 0) {
+		return err;
+	} else {
+		state->nmi_registered = 1;
+	}
+#endif /* defined(CONFIG_SMP) */
+	if (cr_host_state.host_panic) {
+		state->panic_nb.notifier_call = crp_host_trigger_panic;
+		state->panic_nb.priority = INT_MAX;
+		atomic_notifier_chain_register(&panic_notifier_list, &state->panic_nb);
+		state->panic_registered = 1;
+		CRH_PRINTK_INFO("triggering on panic");
+	}
+	if (cr_host_state.host_panic == 2) {
+		state->die_nb.notifier_call = crp_host_trigger_die;
+		state->die_nb.priority = INT_MAX;
+		if ((err = register_die_notifier(&state->die_nb)) < 0) {
+			return err;
+		} else {
+			state->die_registered = 1;
+			CRH_PRINTK_INFO("triggering on oops");
+		}
+	}
+	if (cr_host_state.host_trigger_nkeys || cr_host_state.host_trigger_nsws) {
+		state->input_handler.event = crp_host_trigger_input_event;
+		state->input_handler.match = crp_host_trigger_input_match;
+		state->input_handler.connect = crp_host_trigger_input_connect;
+		state->input_handler.disconnect = crp_host_trigger_input_disconnect;
+		state->input_handler.name = "clearram";
+		state->input_handler.id_table = crp_host_trigger_input_ids;
+		if ((err = input_register_handler(&state->input_handler)) < 0) {
+			return err;
+		} else {
+			state->input_registered = 1;
+		}
+	}
+	if (state->nusb > 0) {
+		state->usb_nb.notifier_call = crp_host_trigger_usb;
+		usb_register_notify(&state->usb_nb);
+		state->usb_registered = 1;
+		CRH_PRINTK_INFO("triggering on removal of %zu USB devices", state->nusb);
+	}
+	if (cr_host_state.host_trigger_acpi) {
+		if (acpi_disabled) {
+			CRH_PRINTK_ERR("ACPI power button trigger requires ACPI");
+			return -ENODEV;
+		}
+		acpi_get_devices(CRH_TRIGGER_ACPI_HID, crp_host_trigger_acpi_add, NULL, NULL);
+		if (state->nacpi_handles == 0) {
+			CRH_PRINTK_ERR("no ACPI power button devices found");
+			return -ENODEV;
+		} else {
+			CRH_PRINTK_INFO("triggering on %zu ACPI power button devices",
+				state->nacpi_handles);
+		}
+	}
+	return 0;
+}
+
+/**
+ * cr_host_tsc_khz() - get TSC frequency
+ *
+ * Return: TSC frequency in kHz as calibrated by the kernel, or as measured
+ * against the monotonic clock over CRH_TSC_CALIBRATE_MS otherwise
+ */
+
+unsigned long cr_host_tsc_khz(void)
+{
+	uint64_t tsc_base;
+	u64 ns_base;
+
+	if (tsc_khz) {
+		return tsc_khz;
+	} else {
+		ns_base = ktime_get_ns();
+		tsc_base = cr_amd64_rdtsc();
+		mdelay(CRH_TSC_CALIBRATE_MS);
+		return ((cr_amd64_rdtsc() - tsc_base) * 1000000)
+			/ max(ktime_get_ns() - ns_base, (u64)1);
 	}
-	cr_host_map_free(cr_host_state.clear_pml4, cr_host_vmfree);
 }
 
 /**
@@ -221,7 +2566,7 @@ uintptr_t cr_host_virt_to_phys(uintptr_t va)
 	pte_t *pte;
 	uintptr_t pe_val, pfn;
 
-	pgd = pgd_offset(current->mm, va);
+	pgd = pgd_offset(current->active_mm, va);
 	pud = pud_offset(pgd, va);
 	pe_val = pud_val(*pud);
 	if (pe_val & _PAGE_PSE) {
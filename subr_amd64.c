@@ -23,6 +23,432 @@
  * AMD64-specific logic
  */
 
+/**
+ * cr_amd64_clear_{stosq,stosb,movnti,avx2,avx512,clzero}() - zero-filling kernels
+ * @va:		page-aligned VA to zero-fill at
+ * @nbytes:	number of bytes to zero-fill, multiple of PAGE_SIZE
+ *
+ * Return: Nothing
+ */
+
+__asm(
+	"\t.section	.text\n"
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_stosq\n"
+	"\t.global	cr_amd64_clear_stosq_restart\n"
+	"\t.global	cr_amd64_clear_stosq_done\n"
+	"\tcr_amd64_clear_stosq:\n"
+	"\t	cld\n"
+	"\t	xorl	%eax,	%eax\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\t	shrq	$3,	%rcx\n"
+	"\tcr_amd64_clear_stosq_restart:\n"
+	"\t	rep	stosq\n"
+	"\tcr_amd64_clear_stosq_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_stosb\n"
+	"\t.global	cr_amd64_clear_stosb_restart\n"
+	"\t.global	cr_amd64_clear_stosb_done\n"
+	"\tcr_amd64_clear_stosb:\n"
+	"\t	cld\n"
+	"\t	xorl	%eax,	%eax\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_clear_stosb_restart:\n"
+	"\t	rep	stosb\n"
+	"\tcr_amd64_clear_stosb_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_movnti\n"
+	"\t.global	cr_amd64_clear_movnti_restart\n"
+	"\t.global	cr_amd64_clear_movnti_done\n"
+	"\tcr_amd64_clear_movnti:\n"
+	"\t	xorl	%eax,	%eax\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_clear_movnti_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_clear_movnti_done\n"
+	"\t1:	movnti	%rax,	0x00(%rdi)\n"
+	"\t	movnti	%rax,	0x08(%rdi)\n"
+	"\t	movnti	%rax,	0x10(%rdi)\n"
+	"\t	movnti	%rax,	0x18(%rdi)\n"
+	"\t	movnti	%rax,	0x20(%rdi)\n"
+	"\t	movnti	%rax,	0x28(%rdi)\n"
+	"\t	movnti	%rax,	0x30(%rdi)\n"
+	"\t	movnti	%rax,	0x38(%rdi)\n"
+	"\t	movnti	%rax,	0x40(%rdi)\n"
+	"\t	movnti	%rax,	0x48(%rdi)\n"
+	"\t	movnti	%rax,	0x50(%rdi)\n"
+	"\t	movnti	%rax,	0x58(%rdi)\n"
+	"\t	movnti	%rax,	0x60(%rdi)\n"
+	"\t	movnti	%rax,	0x68(%rdi)\n"
+	"\t	movnti	%rax,	0x70(%rdi)\n"
+	"\t	movnti	%rax,	0x78(%rdi)\n"
+	"\t	addq	$0x80,	%rdi\n"
+	"\t	subq	$0x80,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_clear_movnti_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_avx2\n"
+	"\t.global	cr_amd64_clear_avx2_restart\n"
+	"\t.global	cr_amd64_clear_avx2_done\n"
+	"\tcr_amd64_clear_avx2:\n"
+	"\t	vpxor	%ymm0,	%ymm0,	%ymm0\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_clear_avx2_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_clear_avx2_done\n"
+	"\t1:	vmovntdq %ymm0,	0x00(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x20(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x40(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x60(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x80(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0xa0(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0xc0(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0xe0(%rdi)\n"
+	"\t	addq	$0x100,	%rdi\n"
+	"\t	subq	$0x100,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_clear_avx2_done:\n"
+	"\t	vzeroupper\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_avx512\n"
+	"\t.global	cr_amd64_clear_avx512_restart\n"
+	"\t.global	cr_amd64_clear_avx512_done\n"
+	"\tcr_amd64_clear_avx512:\n"
+	"\t	vpxord	%zmm0,	%zmm0,	%zmm0\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_clear_avx512_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_clear_avx512_done\n"
+	"\t1:	vmovntdq %zmm0,	0x00(%rdi)\n"
+	"\t	vmovntdq %zmm0,	0x40(%rdi)\n"
+	"\t	vmovntdq %zmm0,	0x80(%rdi)\n"
+	"\t	vmovntdq %zmm0,	0xc0(%rdi)\n"
+	"\t	addq	$0x100,	%rdi\n"
+	"\t	subq	$0x100,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_clear_avx512_done:\n"
+	"\t	vzeroupper\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_clear_clzero\n"
+	"\t.global	cr_amd64_clear_clzero_restart\n"
+	"\t.global	cr_amd64_clear_clzero_done\n"
+	"\tcr_amd64_clear_clzero:\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_clear_clzero_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_clear_clzero_done\n"
+	"\t1:	movq	%rdi,	%rax\n"
+	"\t	clzero\n"
+	"\t	addq	$0x40,	%rax\n"
+	"\t	clzero\n"
+	"\t	addq	$0x40,	%rax\n"
+	"\t	clzero\n"
+	"\t	addq	$0x40,	%rax\n"
+	"\t	clzero\n"
+	"\t	addq	$0x100,	%rdi\n"
+	"\t	subq	$0x100,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_clear_clzero_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+);
+CRA_DECL_CLEAR_KERNEL(stosq);
+CRA_DECL_CLEAR_KERNEL(stosb);
+CRA_DECL_CLEAR_KERNEL(movnti);
+CRA_DECL_CLEAR_KERNEL(avx2);
+CRA_DECL_CLEAR_KERNEL(avx512);
+CRA_DECL_CLEAR_KERNEL(clzero);
+
+/**
+ * cr_amd64_fill_{movnti,avx2}() - pattern-filling kernels
+ * cr_amd64_fill_random_{movnti,avx2}() - pseudo-random pattern-filling kernels
+ * @va:		page-aligned VA to fill at
+ * @nbytes:	number of bytes to fill, multiple of PAGE_SIZE
+ * @qword:	pattern to fill with, or xorshift64 seed
+ *
+ * The pseudo-random kernels run one xorshift64 (13, 7, 17) generator per
+ * qword lane, seeded with qword XOR cr_amd64_fill_lanes, keeping their
+ * state in registers across restarts.
+ *
+ * Return: Nothing
+ */
+
+__asm(
+	"\t.section	.rodata\n"
+	"\t.align	0x20\n"
+	"\tcr_amd64_fill_lanes:\n"
+	"\t	.quad	0x9e3779b97f4a7c14, 0xbf58476d1ce4e5b8\n"
+	"\t	.quad	0x94d049bb133111ea, 0xd6e8feb86659fd92\n"
+	"\t	.quad	0xa0761d6478bd642e, 0xe7037ed1a0b428da\n"
+	"\t	.quad	0x8ebc6af09c88c6e2, 0x589965cc75374cc2\n"
+	"\t.section	.text\n"
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_fill_movnti\n"
+	"\t.global	cr_amd64_fill_movnti_restart\n"
+	"\t.global	cr_amd64_fill_movnti_done\n"
+	"\tcr_amd64_fill_movnti:\n"
+	"\t	movq	%rdx,	%rax\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_fill_movnti_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_fill_movnti_done\n"
+	"\t1:	movnti	%rax,	0x00(%rdi)\n"
+	"\t	movnti	%rax,	0x08(%rdi)\n"
+	"\t	movnti	%rax,	0x10(%rdi)\n"
+	"\t	movnti	%rax,	0x18(%rdi)\n"
+	"\t	movnti	%rax,	0x20(%rdi)\n"
+	"\t	movnti	%rax,	0x28(%rdi)\n"
+	"\t	movnti	%rax,	0x30(%rdi)\n"
+	"\t	movnti	%rax,	0x38(%rdi)\n"
+	"\t	addq	$0x40,	%rdi\n"
+	"\t	subq	$0x40,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_fill_movnti_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_fill_avx2\n"
+	"\t.global	cr_amd64_fill_avx2_restart\n"
+	"\t.global	cr_amd64_fill_avx2_done\n"
+	"\tcr_amd64_fill_avx2:\n"
+	"\t	vmovq	%rdx,	%xmm0\n"
+	"\t	vpbroadcastq %xmm0,	%ymm0\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_fill_avx2_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_fill_avx2_done\n"
+	"\t1:	vmovntdq %ymm0,	0x00(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x20(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x40(%rdi)\n"
+	"\t	vmovntdq %ymm0,	0x60(%rdi)\n"
+	"\t	addq	$0x80,	%rdi\n"
+	"\t	subq	$0x80,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_fill_avx2_done:\n"
+	"\t	vzeroupper\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_fill_random_movnti\n"
+	"\t.global	cr_amd64_fill_random_movnti_restart\n"
+	"\t.global	cr_amd64_fill_random_movnti_done\n"
+	"\tcr_amd64_fill_random_movnti:\n"
+	"\t	movq	%rdx,	%rax\n"
+	"\t	xorq	cr_amd64_fill_lanes(%rip),	%rax\n"
+	"\t	orq	$1,	%rax\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_fill_random_movnti_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_fill_random_movnti_done\n"
+	"\t1:	movq	%rax,	%r8\n"
+	"\t	shlq	$13,	%r8\n"
+	"\t	xorq	%r8,	%rax\n"
+	"\t	movq	%rax,	%r8\n"
+	"\t	shrq	$7,	%r8\n"
+	"\t	xorq	%r8,	%rax\n"
+	"\t	movq	%rax,	%r8\n"
+	"\t	shlq	$17,	%r8\n"
+	"\t	xorq	%r8,	%rax\n"
+	"\t	movnti	%rax,	0x00(%rdi)\n"
+	"\t	addq	$0x08,	%rdi\n"
+	"\t	subq	$0x08,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_fill_random_movnti_done:\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_fill_random_avx2\n"
+	"\t.global	cr_amd64_fill_random_avx2_restart\n"
+	"\t.global	cr_amd64_fill_random_avx2_done\n"
+	"\tcr_amd64_fill_random_avx2:\n"
+	"\t	orq	$1,	%rdx\n"
+	"\t	vmovq	%rdx,	%xmm2\n"
+	"\t	vpbroadcastq %xmm2,	%ymm2\n"
+	"\t	vpxor	cr_amd64_fill_lanes+0x00(%rip),	%ymm2,	%ymm0\n"
+	"\t	vpxor	cr_amd64_fill_lanes+0x20(%rip),	%ymm2,	%ymm1\n"
+	"\t	movq	%rsi,	%rcx\n"
+	"\tcr_amd64_fill_random_avx2_restart:\n"
+	"\t	testq	%rcx,	%rcx\n"
+	"\t	jz	cr_amd64_fill_random_avx2_done\n"
+	"\t1:	vpsllq	$13,	%ymm0,	%ymm2\n"
+	"\t	vpsllq	$13,	%ymm1,	%ymm3\n"
+	"\t	vpxor	%ymm2,	%ymm0,	%ymm0\n"
+	"\t	vpxor	%ymm3,	%ymm1,	%ymm1\n"
+	"\t	vpsrlq	$7,	%ymm0,	%ymm2\n"
+	"\t	vpsrlq	$7,	%ymm1,	%ymm3\n"
+	"\t	vpxor	%ymm2,	%ymm0,	%ymm0\n"
+	"\t	vpxor	%ymm3,	%ymm1,	%ymm1\n"
+	"\t	vpsllq	$17,	%ymm0,	%ymm2\n"
+	"\t	vpsllq	$17,	%ymm1,	%ymm3\n"
+	"\t	vpxor	%ymm2,	%ymm0,	%ymm0\n"
+	"\t	vpxor	%ymm3,	%ymm1,	%ymm1\n"
+	"\t	vmovntdq %ymm0,	0x00(%rdi)\n"
+	"\t	vmovntdq %ymm1,	0x20(%rdi)\n"
+	"\t	addq	$0x40,	%rdi\n"
+	"\t	subq	$0x40,	%rcx\n"
+	"\t	jnz	1b\n"
+	"\tcr_amd64_fill_random_avx2_done:\n"
+	"\t	vzeroupper\n"
+	"\t	sfence\n"
+	"\t	ret\n"
+);
+CRA_DECL_FILL_KERNEL(movnti);
+CRA_DECL_FILL_KERNEL(avx2);
+CRA_DECL_FILL_KERNEL(random_movnti);
+CRA_DECL_FILL_KERNEL(random_avx2);
+
+/**
+ * Zero-filling kernels in ascending order of preference
+ */
+struct cra_clear_kernel cr_amd64_clear_kernels[CRA_CLEAR_KERNELS] = {
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_STOSQ, stosq, 0, 3),
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_STOSB, stosb, CRA_CLEAR_FEAT_ERMS, 0),
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_MOVNTI, movnti, CRA_CLEAR_FEAT_SSE2, 0),
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_AVX2, avx2, CRA_CLEAR_FEAT_AVX2, 0),
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_AVX512, avx512, CRA_CLEAR_FEAT_AVX512F, 0),
+	CRA_INIT_CLEAR_KERNEL(CRA_CLEAR_CLZERO, clzero, CRA_CLEAR_FEAT_CLZERO, 0),
+};
+
+/**
+ * Pattern-filling kernels in ascending order of preference, constant
+ * pattern kernels first
+ */
+struct cra_clear_kernel cr_amd64_fill_kernels[CRA_FILL_KERNELS] = {
+	CRA_INIT_FILL_KERNEL(CRA_FILL_MOVNTI, movnti, CRA_CLEAR_FEAT_SSE2),
+	CRA_INIT_FILL_KERNEL(CRA_FILL_AVX2, avx2, CRA_CLEAR_FEAT_AVX2),
+	CRA_INIT_FILL_KERNEL(CRA_FILL_RANDOM_MOVNTI, random_movnti, CRA_CLEAR_FEAT_SSE2),
+	CRA_INIT_FILL_KERNEL(CRA_FILL_RANDOM_AVX2, random_avx2, CRA_CLEAR_FEAT_AVX2),
+};
+
+/**
+ * cr_amd64_clear() - zero-fill page-aligned range with zero-filling kernel
+ * @kernel:	zero-filling kernel to use
+ * @va:		page-aligned VA to zero-fill at
+ * @nbytes:	number of bytes to zero-fill, multiple of PAGE_SIZE
+ *
+ * Dispatches through direct calls only, as indirect branches may be
+ * routed through thunks that are not mapped once the map is in use.
+ *
+ * Return: Nothing
+ */
+
+void cr_amd64_clear(struct cra_clear_kernel *kernel, uintptr_t va, size_t nbytes)
+{
+	switch (kernel->id) {
+	case CRA_CLEAR_STOSB: cr_amd64_clear_stosb(va, nbytes); break;
+	case CRA_CLEAR_MOVNTI: cr_amd64_clear_movnti(va, nbytes); break;
+	case CRA_CLEAR_AVX2: cr_amd64_clear_avx2(va, nbytes); break;
+	case CRA_CLEAR_AVX512: cr_amd64_clear_avx512(va, nbytes); break;
+	case CRA_CLEAR_CLZERO: cr_amd64_clear_clzero(va, nbytes); break;
+	case CRA_CLEAR_STOSQ:
+	default: cr_amd64_clear_stosq(va, nbytes); break;
+	}
+}
+
+/**
+ * cr_amd64_clear_kernel_select() - select zero-filling kernel supported by CPU
+ * @name:	name of zero-filling kernel to select, or NULL or "" to
+ *		select the most preferred kernel supported by the CPU
+ *
+ * Return: pointer to zero-filling kernel, NULL if not supported or found
+ */
+
+struct cra_clear_kernel *cr_amd64_clear_kernel_select(const char *name)
+{
+	enum cra_clear_feat_bits feat;
+	struct cra_clear_kernel *kernel;
+	int nkernel;
+
+	feat = cr_amd64_cpuid_clear_features();
+	for (nkernel = CRA_CLEAR_KERNELS - 1; nkernel >= 0; nkernel--) {
+		kernel = &cr_amd64_clear_kernels[nkernel];
+		if ((kernel->feat & feat) != kernel->feat) {
+			continue;
+		} else
+		if (!name || !name[0] || !strcmp(name, kernel->name)) {
+			return kernel;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * cr_amd64_cpuid_clear_features() - get zero-filling kernel features supported by CPU and OS
+ *
+ * Return: CRA_CLEAR_FEAT_* bit mask
+ */
+
+static void crp_amd64_cpuid(unsigned long func, unsigned long subfunc, unsigned long *pregs) {
+	__asm volatile(
+		"\tcpuid\n"
+		:"=a"(pregs[0]), "=b"(pregs[1]), "=c"(pregs[2]), "=d"(pregs[3])
+		:"0"(func), "2"(subfunc));
+}
+enum cra_clear_feat_bits cr_amd64_cpuid_clear_features(void)
+{
+	unsigned long regs[4], func_max, func_ext_max, xcr0_lo, xcr0_hi;
+	enum cra_clear_feat_bits feat;
+
+	feat = 0;
+	crp_amd64_cpuid(CRA_CPUID_FUNC_BASIC_HIGHEST, 0, regs);
+	func_max = regs[0];
+	crp_amd64_cpuid(CRA_CPUID_FUNC_BASIC_FEATURES, 0, regs);
+	if (regs[3] & CRA_CPUID_FEAT_BASIC_SSE2) {
+		feat |= CRA_CLEAR_FEAT_SSE2;
+	}
+	xcr0_lo = 0;
+	if ((regs[2] & CRA_CPUID_FEAT_BASIC_OSXSAVE)
+	&&  (regs[2] & CRA_CPUID_FEAT_BASIC_AVX)) {
+		__asm volatile(
+			"\txgetbv\n"
+			:"=a"(xcr0_lo), "=d"(xcr0_hi)
+			:"c"(0));
+	}
+	if (func_max >= CRA_CPUID_FUNC_STRUCT_FEATURES) {
+		crp_amd64_cpuid(CRA_CPUID_FUNC_STRUCT_FEATURES, 0, regs);
+		if (regs[1] & CRA_CPUID_FEAT_STRUCT_ERMS) {
+			feat |= CRA_CLEAR_FEAT_ERMS;
+		}
+		if ((regs[1] & CRA_CPUID_FEAT_STRUCT_AVX2)
+		&&  ((xcr0_lo & (CRA_XCR0_SSE | CRA_XCR0_AVX)) ==
+				(CRA_XCR0_SSE | CRA_XCR0_AVX))) {
+			feat |= CRA_CLEAR_FEAT_AVX2;
+		}
+		if ((regs[1] & CRA_CPUID_FEAT_STRUCT_AVX512F)
+		&&  ((xcr0_lo & (CRA_XCR0_SSE | CRA_XCR0_AVX | CRA_XCR0_AVX512)) ==
+				(CRA_XCR0_SSE | CRA_XCR0_AVX | CRA_XCR0_AVX512))) {
+			feat |= CRA_CLEAR_FEAT_AVX512F;
+		}
+	}
+	crp_amd64_cpuid(CRA_CPUID_FUNC_EXT_HIGHEST, 0, regs);
+	func_ext_max = regs[0];
+	if (func_ext_max >= CRA_CPUID_FUNC_EXT_SIZES) {
+		crp_amd64_cpuid(CRA_CPUID_FUNC_EXT_SIZES, 0, regs);
+		if (regs[1] & CRA_CPUID_FEAT_EXT_CLZERO) {
+			feat |= CRA_CLEAR_FEAT_CLZERO;
+		}
+	}
+	return feat;
+}
+
 /**
  * cr_amd64_cpuid_page_size_from_level() - get largest page size supported at a page table level
  *
@@ -180,6 +606,45 @@ CRA_DECL_EXC_HANDLER(0x11)
 CRA_DECL_EXC_HANDLER_NOCODE(0x12)
 );
 
+/**
+ * cr_amd64_fill() - fill page-aligned range with pattern-filling kernel
+ * @kernel:	pattern-filling kernel to use
+ * @va:		page-aligned VA to fill at
+ * @nbytes:	number of bytes to fill, multiple of PAGE_SIZE
+ * @qword:	pattern to fill with, or seed of pseudo-random kernels
+ *
+ * Dispatches through direct calls only, as per cr_amd64_clear().
+ *
+ * Return: Nothing
+ */
+
+void cr_amd64_fill(struct cra_clear_kernel *kernel, uintptr_t va, size_t nbytes, uint64_t qword)
+{
+	switch (kernel->id) {
+	case CRA_FILL_AVX2: cr_amd64_fill_avx2(va, nbytes, qword); break;
+	case CRA_FILL_RANDOM_MOVNTI: cr_amd64_fill_random_movnti(va, nbytes, qword); break;
+	case CRA_FILL_RANDOM_AVX2: cr_amd64_fill_random_avx2(va, nbytes, qword); break;
+	case CRA_FILL_MOVNTI:
+	default: cr_amd64_fill_movnti(va, nbytes, qword); break;
+	}
+}
+
+/**
+ * cr_amd64_fill_kernel_select() - select most preferred pattern-filling kernel supported by CPU
+ * @random:	select pseudo-random (1) or constant (0) pattern-filling kernel
+ *
+ * Return: pointer to pattern-filling kernel
+ */
+
+struct cra_clear_kernel *cr_amd64_fill_kernel_select(int random)
+{
+	if (cr_amd64_cpuid_clear_features() & CRA_CLEAR_FEAT_AVX2) {
+		return &cr_amd64_fill_kernels[random ? CRA_FILL_RANDOM_AVX2 : CRA_FILL_AVX2];
+	} else {
+		return &cr_amd64_fill_kernels[random ? CRA_FILL_RANDOM_MOVNTI : CRA_FILL_MOVNTI];
+	}
+}
+
 /**
  * XXX
  */
@@ -195,6 +660,21 @@ unsigned char cr_amd64_inb(unsigned short port)
 	return byte;
 }
 
+/**
+ * XXX
+ */
+
+uint16_t cr_amd64_inw(unsigned short port)
+{
+	uint16_t word;
+
+	__asm volatile(
+		"\tmovw		%[port],	%%dx\n"
+		"\tinw		%%dx\n"
+		:"=a"(word) : [port] "r"(port) : "dx");
+	return word;
+}
+
 /**
  * XXX
  */
@@ -250,55 +730,55 @@ void cr_amd64_init_page_ent(struct cra_page_ent *pe, uintptr_t pfn_base, enum cr
 	struct cra_page_ent_2M *pe_2M;
 
 	memset(pe, 0, sizeof(*pe));
-	pe->bits = CRA_PE_PRESENT | extra_bits;
+	pe->bits = CRA_PE_PRESENT | (extra_bits & ~CRA_PE_PAT);
 	pe->nx = pages_nx;
 	if (map_direct && (level == 3)) {
 		pe_1G = (struct cra_page_ent_1G *)pe;
 		pe_1G->pfn_base = pfn_base;
 		pe_1G->bits |= CRA_PE_PAGE_SIZE;
+		pe_1G->pat = !!(extra_bits & CRA_PE_PAT);
 	} else
 	if (map_direct && (level == 2)) {
 		pe_2M = (struct cra_page_ent_2M *)pe;
 		pe_2M->pfn_base = pfn_base;
 		pe_2M->bits |= CRA_PE_PAGE_SIZE;
+		pe_2M->pat = !!(extra_bits & CRA_PE_PAT);
 	} else {
 		pe->pfn_base = pfn_base;
+		if (map_direct && (level == 1) && (extra_bits & CRA_PE_PAT)) {
+			pe->bits |= CRA_PE_PAGE_SIZE;
+		}
 	}
 }
 
 /**
- * XXX
+ * cr_amd64_mem_type_bits() - get {PML4,PDP,PD,PT} entry bits for memory type
+ * @name:	one of "uc", "wc", "wt", or "wb"
+ * @pbits:	pointer to CRA_PE_{CACHE_DISABLE,PAT,WRITE_THROUGH} bits
+ *
+ * Return: 0 on success, <0 if memory type is unknown
  */
 
-void cr_amd64_msleep(unsigned ms)
+int cr_amd64_mem_type_bits(const char *name, enum cra_pe_bits *pbits)
 {
-	unsigned long ns;
-	unsigned short lo, hi;
-	unsigned int count[2], delta, niter;
-
-	ns = ms * 1000 * 1000;
-	do {
-		cr_amd64_outb(0x43, 0x30);
-		cr_amd64_outb(0x40, 0x00);
-		cr_amd64_outb(0x40, 0x00);
-		count[0] = count[1] = 0x10000;
-		for (niter = 0; niter < 8192; niter += delta) {
-			count[0] = count[1];
-			cr_amd64_outb(0x43, 0x00);	/* Latch count value */
-			lo = cr_amd64_inb(0x40);
-			hi = cr_amd64_inb(0x40);
-			count[1] = ((hi << 8) | lo);
-			if ((delta = (count[0] - count[1]))) {
-				if (ns >= 838) {
-					ns -= 838;
-				}
-				if (ns < 838) {
-					break;
-				}
-			}
+	static struct {
+		const char *		name;
+		enum cra_pe_bits	bits;
+	} mem_types[] = {
+		{"uc", CRA_PE_CACHE_DISABLE},
+		{"wc", CRA_PE_PAT},
+		{"wt", CRA_PE_WRITE_THROUGH},
+		{"wb", 0},
+	};
+	size_t nmem_type;
+
+	for (nmem_type = 0; nmem_type < (sizeof(mem_types) / sizeof(mem_types[0]));
+			nmem_type++) {
+		if (!strcmp(name, mem_types[nmem_type].name)) {
+			return *pbits = mem_types[nmem_type].bits, 0;
 		}
-		(void)ns;
-	} while (ns >= 838);
+	}
+	return -EINVAL;
 }
 
 /**
@@ -315,6 +795,286 @@ void cr_amd64_outb(unsigned short port, unsigned char byte)
 		:  "al", "dx");
 }
 
+/**
+ * XXX
+ */
+
+void cr_amd64_outl(unsigned short port, uint32_t dword)
+{
+	__asm volatile(
+		"\tmovl		%[dword],	%%eax\n"
+		"\tmovw		%[port],	%%dx\n"
+		"\toutl		%%eax,		%%dx\n"
+		:: [port] "r"(port), [dword] "r"(dword)
+		:  "eax", "dx");
+}
+
+/**
+ * XXX
+ */
+
+void cr_amd64_outw(unsigned short port, uint16_t word)
+{
+	__asm volatile(
+		"\tmovw		%[word],	%%ax\n"
+		"\tmovw		%[port],	%%dx\n"
+		"\toutw		%%ax,		%%dx\n"
+		:: [port] "r"(port), [word] "r"(word)
+		:  "ax", "dx");
+}
+
+/**
+ * cr_amd64_rdrand() - read random number from RDRAND
+ * @pqword:	pointer to random number
+ *
+ * Retry up to CRA_RDRAND_RETRIES times if no random number is available
+ * yet, as recommended by Intel.
+ *
+ * Return: 0 on success, <0 if RDRAND is not supported or failed
+ */
+
+int cr_amd64_rdrand(uint64_t *pqword)
+{
+	unsigned long regs[4];
+	unsigned char ok;
+	size_t nretry;
+
+	crp_amd64_cpuid(CRA_CPUID_FUNC_BASIC_FEATURES, 0, regs);
+	if (!(regs[2] & CRA_CPUID_FEAT_BASIC_RDRAND)) {
+		return -ENODEV;
+	}
+	for (nretry = 0; nretry < CRA_RDRAND_RETRIES; nretry++) {
+		__asm volatile(
+			"\trdrand	%[qword]\n"
+			"\tsetc	%[ok]\n"
+			: [qword] "=r"(*pqword), [ok] "=qm"(ok)
+			:: "cc");
+		if (ok) {
+			return 0;
+		}
+	}
+	return -EIO;
+}
+
+/**
+ * cr_amd64_rdtsc() - read time-stamp counter
+ *
+ * Return: current TSC value
+ */
+
+uint64_t cr_amd64_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm volatile("\trdtsc\n" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * cr_amd64_reset() - reset system
+ * @reset:	reset method and ACPI FADT reset register, if any
+ *
+ * Return: Nothing if the reset took effect, otherwise after
+ * CRA_RESET_FALLBACK_US for the caller to fall back to a triple fault
+ */
+
+void cr_amd64_reset(struct cra_reset *reset)
+{
+	unsigned niter;
+
+	switch (reset->method) {
+	case CRA_RESET_CF9:
+		cr_amd64_outb(0xcf9, 0x02);	/* System reset, then full reset */
+		cr_amd64_udelay(50);
+		cr_amd64_outb(0xcf9, 0x0e);
+		break;
+	case CRA_RESET_ACPI:
+		switch (reset->acpi_space) {
+		case CRA_RESET_SPACE_IO:
+			cr_amd64_outb(reset->acpi_address, reset->acpi_value);
+			break;
+		case CRA_RESET_SPACE_PCI:
+			cr_amd64_outl(0xcf8, 0x80000000
+				| (((reset->acpi_address >> 32) & 0x1f) << 11)
+				| (((reset->acpi_address >> 16) & 0x07) << 8)
+				| (reset->acpi_address & 0xfc));
+			cr_amd64_outb(0xcfc + (reset->acpi_address & 0x03),
+				reset->acpi_value);
+			break;
+		}
+		break;
+	case CRA_RESET_8042:
+		for (niter = 0; (niter < 0x10000) && (cr_amd64_inb(0x64) & 0x02); niter++) {
+			cr_amd64_udelay(1);
+		}
+		cr_amd64_outb(0x64, 0xfe);	/* Pulse reset line */
+		break;
+	case CRA_RESET_TRIPLE:
+	default:
+		return;
+	}
+	cr_amd64_udelay(CRA_RESET_FALLBACK_US);
+}
+
+/**
+ * cr_amd64_reset_method() - get reset method by name
+ * @name:	triple, cf9, acpi, or 8042
+ * @pmethod:	pointer to reset method
+ *
+ * Return: 0 on success, <0 if name is not a known reset method
+ */
+
+int cr_amd64_reset_method(const char *name, enum cra_reset_method *pmethod)
+{
+	static struct {
+		const char *		name;
+		enum cra_reset_method	method;
+	} methods[] = {
+		{"triple", CRA_RESET_TRIPLE},
+		{"cf9", CRA_RESET_CF9},
+		{"acpi", CRA_RESET_ACPI},
+		{"8042", CRA_RESET_8042},
+	};
+	size_t nmethod;
+
+	for (nmethod = 0; nmethod < (sizeof(methods) / sizeof(methods[0]));
+			nmethod++) {
+		if (!strcmp(name, methods[nmethod].name)) {
+			return *pmethod = methods[nmethod].method, 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/**
+ * cr_amd64_udelay() - busy-wait using the TSC
+ * @us:		number of microseconds to wait for
+ *
+ * Return: Nothing
+ */
+
+void cr_amd64_udelay(unsigned long us)
+{
+	uint64_t tsc_limit;
+
+	tsc_limit = cr_amd64_rdtsc() + ((us * cr_host_state.clear_tsc_khz) / 1000);
+	while (cr_amd64_rdtsc() < tsc_limit) {
+		__asm volatile("\tpause\n");
+	}
+}
+
+/**
+ * cr_amd64_verify_{sse2,avx2,avx512}() - verification kernels
+ * @va:		64-byte aligned VA to start verifying at
+ * @va_limit:	VA to stop verifying at
+ * @stride:	distance between lines verified, multiple of 64 bytes
+ *
+ * Return: VA of first nonzero line, va_limit if all lines verified are zero
+ */
+
+__asm(
+	"\t.section	.text\n"
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_verify_sse2\n"
+	"\tcr_amd64_verify_sse2:\n"
+	"\t	pxor	%xmm1,	%xmm1\n"
+	"\t1:	cmpq	%rsi,	%rdi\n"
+	"\t	jae	2f\n"
+	"\t	movdqa	0x00(%rdi),	%xmm0\n"
+	"\t	por	0x10(%rdi),	%xmm0\n"
+	"\t	por	0x20(%rdi),	%xmm0\n"
+	"\t	por	0x30(%rdi),	%xmm0\n"
+	"\t	pcmpeqb	%xmm1,	%xmm0\n"
+	"\t	pmovmskb %xmm0,	%eax\n"
+	"\t	cmpl	$0xffff,	%eax\n"
+	"\t	jne	3f\n"
+	"\t	addq	%rdx,	%rdi\n"
+	"\t	jmp	1b\n"
+	"\t2:	movq	%rsi,	%rax\n"
+	"\t	ret\n"
+	"\t3:	movq	%rdi,	%rax\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_verify_avx2\n"
+	"\tcr_amd64_verify_avx2:\n"
+	"\t1:	cmpq	%rsi,	%rdi\n"
+	"\t	jae	2f\n"
+	"\t	vmovdqa	0x00(%rdi),	%ymm0\n"
+	"\t	vpor	0x20(%rdi),	%ymm0,	%ymm0\n"
+	"\t	vptest	%ymm0,	%ymm0\n"
+	"\t	jnz	3f\n"
+	"\t	addq	%rdx,	%rdi\n"
+	"\t	jmp	1b\n"
+	"\t2:	movq	%rsi,	%rax\n"
+	"\t	vzeroupper\n"
+	"\t	ret\n"
+	"\t3:	movq	%rdi,	%rax\n"
+	"\t	vzeroupper\n"
+	"\t	ret\n"
+
+	"\t.align	0x10\n"
+	"\t.global	cr_amd64_verify_avx512\n"
+	"\tcr_amd64_verify_avx512:\n"
+	"\t1:	cmpq	%rsi,	%rdi\n"
+	"\t	jae	2f\n"
+	"\t	vmovdqa64 0x00(%rdi),	%zmm0\n"
+	"\t	vptestmq %zmm0,	%zmm0,	%k1\n"
+	"\t	kortestw %k1,	%k1\n"
+	"\t	jnz	3f\n"
+	"\t	addq	%rdx,	%rdi\n"
+	"\t	jmp	1b\n"
+	"\t2:	movq	%rsi,	%rax\n"
+	"\t	vzeroupper\n"
+	"\t	ret\n"
+	"\t3:	movq	%rdi,	%rax\n"
+	"\t	vzeroupper\n"
+	"\t	ret\n"
+);
+
+/**
+ * cr_amd64_verify() - verify lines of range with verification kernel
+ * @kernel:	verification kernel to use
+ * @va:		64-byte aligned VA to start verifying at
+ * @va_limit:	VA to stop verifying at
+ * @stride:	distance between lines verified, multiple of 64 bytes
+ *
+ * Dispatches through direct calls only, as per cr_amd64_clear().
+ *
+ * Return: VA of first nonzero line, va_limit if all lines verified are zero
+ */
+
+uintptr_t cr_amd64_verify(enum cra_verify_kernel_id kernel, uintptr_t va, uintptr_t va_limit, size_t stride)
+{
+	switch (kernel) {
+	case CRA_VERIFY_AVX2: return cr_amd64_verify_avx2(va, va_limit, stride);
+	case CRA_VERIFY_AVX512: return cr_amd64_verify_avx512(va, va_limit, stride);
+	case CRA_VERIFY_SSE2:
+	default: return cr_amd64_verify_sse2(va, va_limit, stride);
+	}
+}
+
+/**
+ * cr_amd64_verify_kernel_select() - select most preferred verification kernel supported by CPU
+ *
+ * Return: verification kernel
+ */
+
+enum cra_verify_kernel_id cr_amd64_verify_kernel_select(void)
+{
+	enum cra_clear_feat_bits feat;
+
+	feat = cr_amd64_cpuid_clear_features();
+	if (feat & CRA_CLEAR_FEAT_AVX512F) {
+		return CRA_VERIFY_AVX512;
+	} else
+	if (feat & CRA_CLEAR_FEAT_AVX2) {
+		return CRA_VERIFY_AVX2;
+	} else {
+		return CRA_VERIFY_SSE2;
+	}
+}
+
 /*
  * vim:fileencoding=utf-8 foldmethod=marker noexpandtab sw=8 ts=8 tw=120
  */
@@ -20,109 +20,974 @@
 #include "clearram.h"
 
 static const char *crp_clear_cpu_reg_names[] = {CRC_CPU_REGS_NAMES};
+static const char *crp_clear_pattern_names[] = {CRC_PATTERN_NAMES};
 
 /*
  * XXX
  */
 
 /**
- * cr_clear_clear() - zero-fill RAM
+ * crp_clear_deadline_expired() - check time budget
+ *
+ * If a time budget is set, no further chunks are taken once the TSC passes
+ * the deadline, and the boot CPU resets the system without counting down
+ * as soon as all CPUs have finished their current one. Dry runs are always
+ * bounded by a time budget of at most CRC_DRY_RUN_MS_MAX, which is checked
+ * after each 2 MB overwritten rather than after each chunk.
+ *
+ * Return: 1 if the deadline has passed, 0 otherwise
+ */
+
+static int crp_clear_deadline_expired(void) {
+	return cr_host_state.clear_tsc_deadline
+	    && (cr_amd64_rdtsc() >= cr_host_state.clear_tsc_deadline);
+}
+
+/**
+ * crp_clear_{skip_scan,clear_run,clear_block,clear_range}() - overwrite range of RAM
+ *
+ * Overwrite each run of pages not marked in the skip bitmap with each pass
+ * in cr_host_state.clear_passes in turn, all passes over one run before the
+ * next, and count the bytes overwritten less those skipped after faults as
+ * zero-filled. Unless during a dry run, the boot CPU prints the current VA
+ * into the footer and a period per GB cleared, stopping short of
+ * CRC_VGA_STATUS_ROWS rows above the node bars, which are left to the
+ * outcome printed below the periods.
+ *
+ * Return: Next VA (not) marked in the skip bitmap, VA up to which the range
+ * was overwritten, or nothing
+ */
+
+static uintptr_t crp_clear_skip_scan(uintptr_t va, uintptr_t va_limit, int skip) {
+	uint64_t qword;
+	uintptr_t va_next;
+
+	while (va < va_limit) {
+		qword = *CRHS_SKIP_MAP(va);
+		qword = (skip ? qword : ~qword) & -CRHS_SKIP_BIT(va);
+		if (qword) {
+			va_next = ((va & -(PAGE_SIZE * 64))
+				+ (__builtin_ctzll(qword) * PAGE_SIZE));
+			return (va_next > va) ? min(va_next, va_limit) : va;
+		} else {
+			va = (va & -(PAGE_SIZE * 64)) + (PAGE_SIZE * 64);
+		}
+	}
+	return va_limit;
+}
+
+static void crp_clear_clear_run(struct crc_cpu *cpu, uintptr_t va, size_t nbytes) {
+	size_t npass;
+	uint64_t qword;
+
+	for (npass = 0; npass < cr_host_state.clear_npasses; npass++) {
+		switch (cr_host_state.clear_passes[npass]) {
+		case CRC_PATTERN_ONES:
+			cpu->clear_kernel = cr_host_state.clear_fill_kernel;
+			qword = 0xffffffffffffffffULL; break;
+		case CRC_PATTERN_ALT:
+			cpu->clear_kernel = cr_host_state.clear_fill_kernel;
+			qword = 0x5555555555555555ULL; break;
+		case CRC_PATTERN_ALTINV:
+			cpu->clear_kernel = cr_host_state.clear_fill_kernel;
+			qword = 0xaaaaaaaaaaaaaaaaULL; break;
+		case CRC_PATTERN_RANDOM:
+			cpu->clear_kernel = cr_host_state.clear_fill_random_kernel;
+			qword = ((va ^ cr_host_state.clear_pattern_seed) * 0x9e3779b97f4a7c15ULL)
+				^ ((npass + 1) * 0xbf58476d1ce4e5b9ULL);
+			break;
+		case CRC_PATTERN_ZERO:
+		default:
+			cpu->clear_kernel = cr_host_state.clear_kernel;
+			qword = 0; break;
+		}
+		cpu->clear_flag = 1;
+		if (cpu->clear_kernel == cr_host_state.clear_kernel) {
+			cr_amd64_clear(cpu->clear_kernel, va, nbytes);
+		} else {
+			cr_amd64_fill(cpu->clear_kernel, va, nbytes, qword);
+		}
+		cpu->clear_flag = 0;
+	}
+}
+
+static void crp_clear_clear_block(struct crc_cpu *cpu, uintptr_t va_base, size_t nbytes) {
+	uintptr_t va_cur, va_limit, va_run;
+	size_t nbytes_skipped;
+
+	for (va_cur = va_base, va_limit = va_base + nbytes;
+			va_cur < va_limit; va_cur = va_run) {
+		va_cur = crp_clear_skip_scan(va_cur, va_limit, 0);
+		va_run = crp_clear_skip_scan(va_cur, va_limit, 1);
+		if (va_cur < va_run) {
+			nbytes_skipped = cpu->nbytes_skipped;
+			crp_clear_clear_run(cpu, va_cur, va_run - va_cur);
+			nbytes_skipped = cpu->nbytes_skipped - nbytes_skipped;
+			if (nbytes_skipped < (va_run - va_cur)) {
+				cpu->nbytes_zeroed += (va_run - va_cur) - nbytes_skipped;
+			}
+		}
+	}
+}
+
+static uintptr_t crp_clear_clear_range(struct crc_cpu *cpu, uintptr_t va_base, uintptr_t va_limit, uintptr_t va_ent_limit) {
+	uintptr_t va_cur, vga_footer;
+	size_t unit, nbytes;
+
+	unit = cr_host_state.clear_chunk_size;
+	if (cr_host_state.clear_dry_run) {
+		unit = min(unit, (size_t)(PAGE_SIZE * CRA_PS_2M));
+	}
+	for (va_cur = va_base; (va_cur < va_limit)
+			&& !(cr_host_state.clear_dry_run && crp_clear_deadline_expired());
+			va_cur += nbytes) {
+		nbytes = unit - (va_cur & (unit - 1));
+		if (nbytes > (va_limit - va_cur)) {
+			nbytes = va_limit - va_cur;
+		}
+		if ((cpu->ncpu == cr_host_state.clear_cpu_boot)
+		&&  !cr_host_state.clear_dry_run) {
+			vga_footer = (uintptr_t)cr_host_state.clear_vga;
+			vga_footer += (2 * 80 * (25 - 1));
+			cr_clear_vga_print_hnum(&vga_footer, va_cur, 0x1f, 1);
+		}
+		crp_clear_clear_block(cpu, va_cur, nbytes);
+		if ((cpu->ncpu == cr_host_state.clear_cpu_boot)
+		&&  !cr_host_state.clear_dry_run
+		&&  (cr_host_state.clear_va_vga_cur < cr_host_state.clear_va_vga_limit)
+		&&  ((((va_cur + nbytes) & ((PAGE_SIZE * CRA_PS_1G) - 1)) == 0)
+		||   ((va_cur + nbytes) == va_ent_limit))) {
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, ".", 0x1f, 1);
+		}
+	}
+	return va_cur;
+}
+
+/**
+ * crp_clear_pattern_seed() - draw secret for random overwrite patterns
+ *
+ * Random patterns are seeded from the VA, the pass, and a secret drawn from
+ * RDRAND, if supported, and the TSC by the boot CPU at the start, which
+ * cr_clear_clear() forgets again once all CPUs have finished.
  *
  * Return: Nothing
  */
 
-static void crp_clear_clear_block(uintptr_t va_base, size_t qwords) {
-	uintptr_t clear_qword;
+static void crp_clear_pattern_seed(void) {
+	uint64_t qword;
 
-	clear_qword = 0x0ULL;
-	cr_host_state.clear_clear_flag = 1;	/* XXX not atomic */
-	__asm volatile(
-		"\tcld\n"
-		"\tmovq		%[qword],	%%rax\n"
-		"\tmovq		%[count],	%%rcx\n"
-		"\tmovq		%[va],		%%rdi\n"
-		"\trep		stosq\n"
-		:: [qword] "r"(clear_qword), [count] "r"(qwords/8), [va] "r"(va_base)
-		:  "rax", "rcx","rdi", "flags");
-	cr_host_state.clear_clear_flag = 0;	/* XXX not atomic */
+	cr_host_state.clear_pattern_seed = cr_amd64_rdtsc() * 0xbf58476d1ce4e5b9ULL;
+	if (cr_amd64_rdrand(&qword) == 0) {
+		cr_host_state.clear_pattern_seed ^= qword;
+	}
+}
+
+/**
+ * crp_clear_chunk_{ent,range}() - get clear plan entry and VA range of chunk
+ *
+ * Return: Clear plan entry in the map, or nothing
+ */
+
+static struct crc_plan_ent *crp_clear_chunk_ent(struct crc_queue *queue, size_t nchunk) {
+	size_t nent_lo, nent_hi, nent_mid;
+
+	for (nent_lo = queue->nent_base, nent_hi = queue->nent_base + queue->nents;
+			(nent_hi - nent_lo) > 1;) {
+		nent_mid = nent_lo + ((nent_hi - nent_lo) / 2);
+		if (CRHS_PLAN_MAP(nent_mid)->nchunk_base <= nchunk) {
+			nent_lo = nent_mid;
+		} else {
+			nent_hi = nent_mid;
+		}
+	}
+	return CRHS_PLAN_MAP(nent_lo);
+}
+
+static void crp_clear_chunk_range(struct crc_queue *queue, size_t nchunk, uintptr_t *pva_base, uintptr_t *pva_limit) {
+	struct crc_plan_ent *ent;
+	size_t unit;
+
+	ent = crp_clear_chunk_ent(queue, nchunk);
+	unit = cr_host_state.clear_chunk_size;
+	*pva_base = (ent->va & -unit) + ((nchunk - ent->nchunk_base) * unit);
+	*pva_limit = *pva_base + unit;
+	if (*pva_base < ent->va) {
+		*pva_base = ent->va;
+	}
+	if (*pva_limit > (ent->va + ent->nbytes)) {
+		*pva_limit = ent->va + ent->nbytes;
+	}
+}
+
+/**
+ * crp_clear_telemetry{,_pfn,_start,_done}() - fill in telemetry record
+ *
+ * If a telemetry record page is mapped and not during a dry run, the boot
+ * CPU initialises the record at the start and completes it with the ranges
+ * skipped, the nonzero lines found, and the outcome before resetting, while
+ * crp_clear_clear_chunk() adds the bytes of each chunk cleared to the
+ * counter of its NUMA node as they are cleared.
+ *
+ * Return: Record in the map or NULL, PFN of VA or 0, or nothing
+ */
+
+static struct cr_telemetry *crp_clear_telemetry(void) {
+	if (!cr_host_state.clear_telemetry_addr || cr_host_state.clear_dry_run) {
+		return NULL;
+	} else {
+		return CRHS_TELEMETRY();
+	}
+}
+
+static uintptr_t crp_clear_telemetry_pfn(uintptr_t va) {
+	struct crc_plan_ent *ent;
+	size_t nent;
+
+	for (nent = 0; nent < cr_host_state.clear_nplan; nent++) {
+		ent = CRHS_PLAN_MAP(nent);
+		if ((va >= ent->va) && (va < (ent->va + ent->nbytes))) {
+			return ent->pfn + ((va - ent->va) / PAGE_SIZE);
+		}
+	}
+	return 0;
+}
+
+static void crp_clear_telemetry_start(void) {
+	struct cr_telemetry *telemetry;
+	volatile uint64_t *qword;
+	size_t nqword;
+
+	if (!(telemetry = crp_clear_telemetry())) {
+		return;
+	}
+	for (nqword = 0, qword = (volatile uint64_t *)telemetry;
+			nqword < (sizeof(*telemetry) / sizeof(*qword)); nqword++) {
+		qword[nqword] = 0;
+	}
+	telemetry->version = CR_TELEMETRY_VERSION;
+	telemetry->state = CR_TELEMETRY_CLEARING;
+	telemetry->tsc_khz = cr_host_state.clear_tsc_khz;
+	telemetry->tsc_trigger = cr_host_state.clear_tsc_trigger;
+	telemetry->tsc_stop = cr_host_state.clear_tsc_stop;
+	telemetry->tsc_start = cr_host_state.clear_tsc_start;
+	telemetry->ncpus = cr_host_state.clear_ncpus;
+	__atomic_store_n(&telemetry->magic, CR_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void crp_clear_telemetry_done(int expired) {
+	struct cr_telemetry *telemetry;
+	struct crc_cpu *cpu;
+	size_t ncpu, nskip, nskip_telemetry;
+
+	if (!(telemetry = crp_clear_telemetry())) {
+		return;
+	}
+	for (ncpu = 0, nskip_telemetry = 0; ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (!cpu->clear) {
+			continue;
+		}
+		for (nskip = 0; (nskip < cpu->nskips)
+				&& (nskip_telemetry < CR_TELEMETRY_SKIPS_MAX); nskip++) {
+			telemetry->skips[nskip_telemetry].pfn =
+				crp_clear_telemetry_pfn(cpu->skips[nskip].va_base);
+			telemetry->skips[nskip_telemetry++].npages =
+				(cpu->skips[nskip].va_limit - cpu->skips[nskip].va_base) / PAGE_SIZE;
+		}
+		telemetry->nskips += cpu->nskips;
+		telemetry->nbytes_skipped += cpu->nbytes_skipped;
+		telemetry->nnonzero += cpu->nnonzero;
+	}
+	telemetry->tsc_end = cr_amd64_rdtsc();
+	__atomic_store_n(&telemetry->state,
+		expired ? CR_TELEMETRY_EXPIRED : CR_TELEMETRY_DONE, __ATOMIC_RELEASE);
+}
+
+/**
+ * crp_clear_serial_{begin,field,end}() - write one line to the UART
+ *
+ * Lines are written whole under cr_host_state.clear_serial_lock, by the
+ * boot CPU and by any CPU taking a fault or dumping its registers. If the
+ * lock cannot be taken within CRC_SERIAL_LOCK_MS, or CRC_SERIAL_LOCK_POLLS_MAX
+ * polls if the TSC frequency is unknown, the line is dropped, and
+ * crp_clear_serial_end() must only be called if crp_clear_serial_begin()
+ * returned 1.
+ *
+ * Return: 1 if the line was begun, 0 otherwise, or nothing
+ */
+
+static int crp_clear_serial_begin(const char *str) {
+	uint64_t tsc_limit;
+	size_t npoll;
+
+	if (!cr_host_state.clear_serial_port || cr_host_state.clear_dry_run) {
+		return 0;
+	}
+	tsc_limit = cr_amd64_rdtsc() + (CRC_SERIAL_LOCK_MS * cr_host_state.clear_tsc_khz);
+	for (npoll = 0; __atomic_exchange_n(&cr_host_state.clear_serial_lock, 1, __ATOMIC_ACQUIRE);
+			npoll++) {
+		if (cr_host_state.clear_tsc_khz
+		    ? (cr_amd64_rdtsc() >= tsc_limit) : (npoll >= CRC_SERIAL_LOCK_POLLS_MAX)) {
+			return 0;	/* Drop the line rather than interleave it */
+		}
+		__asm volatile("\tpause\n");
+	}
+	cr_clear_serial_print_cstr("clearram: ");
+	cr_clear_serial_print_cstr(str);
+	return 1;
+}
+
+static void crp_clear_serial_field(const char *name, uintptr_t u64) {
+	cr_clear_serial_print_cstr(" ");
+	cr_clear_serial_print_cstr(name);
+	cr_clear_serial_print_cstr("=");
+	cr_clear_serial_print_hnum(u64);
+}
+
+static void crp_clear_serial_end(void) {
+	cr_clear_serial_print_cstr("\n");
+	__atomic_store_n(&cr_host_state.clear_serial_lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * crp_clear_{nbytes_cleared,vga_nbars,vga_footer}() - render progress footer
+ *
+ * After each chunk it clears, the boot CPU renders the throughput and the
+ * estimated time remaining into the footer next to the current VA, and,
+ * with multiple clearing CPUs, one bar of the chunks cleared per NUMA node
+ * with chunks to clear above it. The throughput is derived from the TSC and
+ * the bytes actually zero-filled by all CPUs so far, excluding those skipped
+ * after faults or in the skip bitmap, and the time remaining from it and the
+ * bytes of the clear plan not yet cleared.
+ *
+ * Return: Bytes cleared or zero-filled, number of bars, or nothing
+ */
+
+static size_t crp_clear_nbytes_cleared(int zeroed) {
+	struct crc_cpu *cpu;
+	size_t ncpu, nbytes;
+
+	for (ncpu = 0, nbytes = 0; ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (cpu->clear) {
+			nbytes += zeroed ? cpu->nbytes_zeroed : cpu->nbytes_cleared;
+		}
+	}
+	return nbytes;
+}
+
+static size_t crp_clear_vga_nbars(void) {
+	size_t nbars;
+	int nid;
+
+	if (cr_host_state.clear_ncpus <= 1) {
+		return 0;
+	}
+	for (nid = 0, nbars = 0; nid < CRHS_NODES_MAX; nid++) {
+		if (cr_host_state.clear_queues[nid].nchunks && (nbars < CRC_VGA_BARS_MAX)) {
+			nbars++;
+		}
+	}
+	return nbars;
+}
+
+static void crp_clear_vga_footer(void) {
+	struct crc_queue *queue;
+	uintptr_t vga_footer, vga_blank, vga_bar;
+	size_t nbytes, nbytes_left, nbar, nbars;
+	uint64_t ms, nbytes_ms, eta_s;
+	int nid;
+
+	if (!cr_host_state.clear_tsc_khz) {
+		return;
+	}
+	nbytes = crp_clear_nbytes_cleared(0);
+	nbytes_left = (cr_host_state.clear_nbytes_total > nbytes)
+		? (cr_host_state.clear_nbytes_total - nbytes) : 0;
+	ms = (cr_amd64_rdtsc() - cr_host_state.clear_tsc_start) / cr_host_state.clear_tsc_khz;
+	nbytes_ms = crp_clear_nbytes_cleared(1) / max(ms, (uint64_t)1);
+	vga_footer = (uintptr_t)cr_host_state.clear_vga;
+	vga_footer += (2 * 80 * (25 - 1)) + (2 * 19);	/* Past the current VA */
+	vga_blank = vga_footer;
+	cr_clear_vga_print_cstr(&vga_blank, "                              ", 0x1f, 1);
+	cr_clear_vga_print_dnum(&vga_footer, nbytes_ms / 1000, 0, 0x1f, 1);
+	cr_clear_vga_print_cstr(&vga_footer, " MB/s, ETA ", 0x1f, 1);
+	if (nbytes_ms) {
+		eta_s = (nbytes_left / nbytes_ms) / 1000;
+		cr_clear_vga_print_dnum(&vga_footer, eta_s / 60, 2, 0x1f, 1);
+		cr_clear_vga_print_cstr(&vga_footer, ":", 0x1f, 1);
+		cr_clear_vga_print_dnum(&vga_footer, eta_s % 60, 2, 0x1f, 1);
+	} else {
+		cr_clear_vga_print_cstr(&vga_footer, "--:--", 0x1f, 1);
+	}
+	for (nid = 0, nbar = 0, nbars = crp_clear_vga_nbars(); (nid < CRHS_NODES_MAX) && (nbar < nbars); nid++) {
+		queue = &cr_host_state.clear_queues[nid];
+		if (queue->nchunks) {
+			vga_bar = (uintptr_t)cr_host_state.clear_vga;
+			vga_bar += 2 * 80 * ((25 - 1) - nbars + nbar++);
+			cr_clear_vga_print_cstr(&vga_bar, "node ", 0x1f, 1);
+			cr_clear_vga_print_hnum(&vga_bar, nid, 0x1f, 1);
+			cr_clear_vga_print_cstr(&vga_bar, " ", 0x1f, 1);
+			cr_clear_vga_print_bar(&vga_bar,
+				__atomic_load_n(&queue->nchunks_done, __ATOMIC_RELAXED),
+				queue->nchunks, CRC_VGA_BAR_WIDTH, 0x1f);
+		}
+	}
+}
+
+/**
+ * crp_clear_serial_{throughput,start,progress,done}() - report progress to the UART
+ *
+ * If a UART is configured and not during a dry run, the boot CPU writes a
+ * line with the latency from the trigger to the start of clearing when
+ * starting, one with the bytes cleared and the throughput at most every
+ * CRC_SERIAL_PROGRESS_MS, and one with the outcome.
+ *
+ * Return: Nothing
+ */
+
+static void crp_clear_serial_throughput(uint64_t tsc) {
+	size_t nbytes;
+	uint64_t ms;
+
+	nbytes = crp_clear_nbytes_cleared(0);
+	ms = cr_host_state.clear_tsc_khz
+		? ((tsc - cr_host_state.clear_tsc_start) / cr_host_state.clear_tsc_khz) : 0;
+	crp_clear_serial_field("ms", ms);
+	crp_clear_serial_field("bytes", nbytes);
+	crp_clear_serial_field("mbps",
+		crp_clear_nbytes_cleared(1) / (max(ms, (uint64_t)1) * 1000));
+}
+
+static void crp_clear_serial_start(void) {
+	size_t nid, nchunks;
+
+	if (!cr_host_state.clear_serial_port || cr_host_state.clear_dry_run) {
+		return;
+	}
+	cr_clear_serial_init();
+	cr_host_state.clear_serial_tsc_next = cr_host_state.clear_tsc_start
+		+ (CRC_SERIAL_PROGRESS_MS * cr_host_state.clear_tsc_khz);
+	for (nid = 0, nchunks = 0; nid < CRHS_NODES_MAX; nid++) {
+		nchunks += cr_host_state.clear_queues[nid].nchunks;
+	}
+	if (crp_clear_serial_begin("start")) {
+		crp_clear_serial_field("cpus", cr_host_state.clear_ncpus);
+		crp_clear_serial_field("chunks", nchunks);
+		crp_clear_serial_field("chunk_size", cr_host_state.clear_chunk_size);
+		crp_clear_serial_field("tsc_khz", cr_host_state.clear_tsc_khz);
+		if (cr_host_state.clear_tsc_khz && cr_host_state.clear_tsc_trigger) {
+			crp_clear_serial_field("latency_us",
+				((cr_host_state.clear_tsc_start - cr_host_state.clear_tsc_trigger) * 1000)
+				/ cr_host_state.clear_tsc_khz);
+		}
+		crp_clear_serial_end();
+	}
+}
+
+static void crp_clear_serial_progress(void) {
+	uint64_t tsc;
+
+	tsc = cr_amd64_rdtsc();
+	if (tsc < cr_host_state.clear_serial_tsc_next) {
+		return;
+	} else
+	if (crp_clear_serial_begin("progress")) {
+		cr_host_state.clear_serial_tsc_next = tsc
+			+ (CRC_SERIAL_PROGRESS_MS * cr_host_state.clear_tsc_khz);
+		crp_clear_serial_throughput(tsc);
+		crp_clear_serial_end();
+	}
+}
+
+static void crp_clear_serial_done(int expired) {
+	struct crc_cpu *cpu;
+	size_t ncpu, nbytes_skipped, nnonzero;
+
+	if (crp_clear_serial_begin(expired ? "expired" : "done")) {
+		for (ncpu = 0, nbytes_skipped = 0, nnonzero = 0;
+				ncpu < cr_host_state.host_cpu_count; ncpu++) {
+			cpu = CRHS_CPU_MAP(ncpu);
+			if (cpu->clear) {
+				nbytes_skipped += cpu->nbytes_skipped;
+				nnonzero += cpu->nnonzero;
+			}
+		}
+		crp_clear_serial_throughput(cr_amd64_rdtsc());
+		crp_clear_serial_field("skipped", nbytes_skipped);
+		crp_clear_serial_field("nonzero", nnonzero);
+		crp_clear_serial_end();
+	}
+}
+
+/**
+ * crp_clear_{clear,verify}_chunk() - overwrite or verify chunk
+ *
+ * If verification is enabled and the last pass zero-fills, all clearing
+ * CPUs verify chunks taken from the queues a second time once all of them
+ * have finished zero-filling and written back and invalidated their caches,
+ * so that zeroes are read back from RAM rather than from cache, and record
+ * the number and first VAs of nonzero lines found.
+ *
+ * Return: Nothing
+ */
+
+static void crp_clear_clear_chunk(struct crc_cpu *cpu, struct crc_queue *queue, size_t nchunk) {
+	struct cr_telemetry *telemetry;
+	struct crc_plan_ent *ent;
+	uintptr_t va_base, va_limit;
+	size_t nid;
+
+	crp_clear_chunk_range(queue, nchunk, &va_base, &va_limit);
+	ent = crp_clear_chunk_ent(queue, nchunk);
+	va_limit = crp_clear_clear_range(cpu, va_base, va_limit, ent->va + ent->nbytes);
+	cpu->nbytes_cleared += va_limit - va_base;
+	nid = queue - cr_host_state.clear_queues;
+	if ((telemetry = crp_clear_telemetry()) && (nid < CR_TELEMETRY_NODES_MAX)) {
+		__atomic_add_fetch(&telemetry->nbytes_nodes[nid],
+			va_limit - va_base, __ATOMIC_RELAXED);
+	}
+	if (cpu->ncpu == cr_host_state.clear_cpu_boot) {
+		if (!cr_host_state.clear_dry_run) {
+			crp_clear_vga_footer();
+		}
+		crp_clear_serial_progress();
+	}
+}
+
+static void crp_clear_verify_chunk(struct crc_cpu *cpu, struct crc_queue *queue, size_t nchunk) {
+	uintptr_t va_base, va_limit, va_cur, va_run;
+	size_t stride;
+
+	crp_clear_chunk_range(queue, nchunk, &va_base, &va_limit);
+	stride = cr_host_state.clear_verify_stride;
+	for (va_cur = va_base; va_cur < va_limit; va_cur = va_run) {
+		va_cur = crp_clear_skip_scan(va_cur, va_limit, 0);
+		va_run = crp_clear_skip_scan(va_cur, va_limit, 1);
+		while ((va_cur = cr_amd64_verify(cr_host_state.clear_verify_kernel,
+				va_cur, va_run, stride)) < va_run) {
+			if (cpu->nnonzero < CRC_NONZERO_MAX) {
+				cpu->va_nonzero[cpu->nnonzero] = va_cur;
+			}
+			cpu->nnonzero++;
+			va_cur += stride;
+		}
+	}
+}
+
+/**
+ * crp_clear_queue_{next,take}() - select queue and take next chunk from it
+ *
+ * Chunks are taken from the queue whose next chunk has the highest priority,
+ * preferring the queue of the NUMA node of the calling CPU and then those of
+ * the other nodes in turn, including those without any clearing CPUs.
+ *
+ * Return: Queue or NULL if all are empty, 1 if a chunk was taken or 0
+ */
+
+static struct crc_queue *crp_clear_queue_next(struct crc_cpu *cpu) {
+	struct crc_queue *queue, *queue_next;
+	size_t nchunk;
+	int nqueue, nid, priority, priority_next;
+
+	for (nqueue = 0, queue_next = NULL, priority_next = 0;
+			nqueue < CRHS_NODES_MAX; nqueue++) {
+		nid = (cpu->nid + nqueue) % CRHS_NODES_MAX;
+		queue = &cr_host_state.clear_queues[nid];
+		nchunk = __atomic_load_n(&queue->nchunk_next, __ATOMIC_RELAXED);
+		if (nchunk < queue->nchunks) {
+			priority = crp_clear_chunk_ent(queue, nchunk)->priority;
+			if (!queue_next || (priority > priority_next)) {
+				queue_next = queue, priority_next = priority;
+			}
+		}
+	}
+	return queue_next;
+}
+
+static int crp_clear_queue_take(struct crc_queue *queue, volatile size_t *pnchunk_next, size_t *pnchunk) {
+	size_t nchunk;
+
+	if (__atomic_load_n(pnchunk_next, __ATOMIC_RELAXED) >= queue->nchunks) {
+		return 0;
+	} else
+	if ((nchunk = __atomic_fetch_add(pnchunk_next, 1,
+			__ATOMIC_RELAXED)) >= queue->nchunks) {
+		return 0;
+	} else {
+		return *pnchunk = nchunk, 1;
+	}
+}
+
+/**
+ * crp_clear_print_{verify,skips,flush,pci,latency}() - print outcome
+ *
+ * Print the number and first VAs of nonzero lines found, the ranges skipped
+ * after repeated faults, the bytes of dirty file pages left after flushing
+ * storage, if flushed, the number of PCI bus masters quiesced, if quiesced,
+ * and, in debug builds, each quiesced function, and the latency from the
+ * trigger to the start of clearing and that of the slowest CPU to stop,
+ * measured on the TSC.
+ *
+ * Return: Nothing
+ */
+
+static void crp_clear_print_verify(void) {
+	struct crc_cpu *cpu;
+	size_t ncpu, nnonzero, nva;
+
+	for (ncpu = 0, nnonzero = 0; ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (cpu->clear) {
+			nnonzero += cpu->nnonzero;
+		}
+	}
+	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "verified, ", 0x1f, 1);
+	cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur, nnonzero,
+		nnonzero ? 0x1c : 0x1f, 1);
+	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " nonzero lines", 0x1f, 1);
+	for (ncpu = 0, nva = 0; (ncpu < cr_host_state.host_cpu_count)
+			&& (nva < CRC_NONZERO_MAX); ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (cpu->clear && (cpu->nnonzero > 0)) {
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " ", 0x1f, 1);
+			cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+				cpu->va_nonzero[0], 0x1c, 1);
+			nva++;
+		}
+	}
+	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, ", ", 0x1f, 1);
+}
+
+static void crp_clear_print_skips(void) {
+	struct crc_cpu *cpu;
+	size_t ncpu, nskips, nbytes_skipped;
+
+	for (ncpu = 0, nskips = 0, nbytes_skipped = 0;
+			ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (cpu->clear) {
+			nskips += cpu->nskips;
+			nbytes_skipped += cpu->nbytes_skipped;
+		}
+	}
+	if (nskips > 0) {
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "skipped ", 0x1f, 1);
+		cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur, nbytes_skipped, 0x1f, 1);
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " bytes in ", 0x1f, 1);
+		cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur, nskips, 0x1f, 1);
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " ranges, ", 0x1f, 1);
+	}
+}
+
+static void crp_clear_print_flush(void) {
+	if (cr_host_state.clear_flushed) {
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "flushed, ", 0x1f, 1);
+		cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+			cr_host_state.clear_flush_nbytes_dirty,
+			cr_host_state.clear_flush_nbytes_dirty ? 0x1c : 0x1f, 1);
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " dirty bytes left, ", 0x1f, 1);
+	}
+}
+
+static void crp_clear_print_pci(void) {
+#if defined(DEBUG)
+	size_t nfn;
+#endif /* defined(DEBUG) */
+
+	if (cr_host_state.clear_pci_quiesced) {
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "quiesced ", 0x1f, 1);
+		cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+			cr_host_state.clear_npci_fns, 0x1f, 1);
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " bus masters", 0x1f, 1);
+#if defined(DEBUG)
+		for (nfn = 0; (nfn < cr_host_state.clear_npci_fns)
+				&& (nfn < CRC_PCI_FNS_MAX); nfn++) {
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " ", 0x1f, 1);
+			cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+				cr_host_state.clear_pci_fns[nfn], 0x1f, 1);
+		}
+#endif /* defined(DEBUG) */
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, ", ", 0x1f, 1);
+	}
+}
+
+static void crp_clear_print_latency(void) {
+	struct crc_cpu *cpu;
+	size_t ncpu;
+	uint64_t tsc_stopped;
+
+	if (!cr_host_state.clear_tsc_khz) {
+		return;
+	} else
+	if (cr_host_state.clear_tsc_trigger) {
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "latency ", 0x1f, 1);
+		cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+			((cr_host_state.clear_tsc_start - cr_host_state.clear_tsc_trigger) * 1000)
+			/ cr_host_state.clear_tsc_khz, 0x1f, 1);
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " us, ", 0x1f, 1);
+	}
+	if (!cr_host_state.clear_tsc_stop) {
+		return;
+	}
+	for (ncpu = 0, tsc_stopped = cr_host_state.clear_tsc_stop;
+			ncpu < cr_host_state.host_cpu_count; ncpu++) {
+		cpu = CRHS_CPU_MAP(ncpu);
+		if (cpu->tsc_stopped > tsc_stopped) {
+			tsc_stopped = cpu->tsc_stopped;
+		}
+	}
+	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "stopped in ", 0x1f, 1);
+	cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur,
+		((tsc_stopped - cr_host_state.clear_tsc_stop) * 1000)
+		/ cr_host_state.clear_tsc_khz, 0x1f, 1);
+	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " us, ", 0x1f, 1);
 }
 
-static void crp_clear_halt(void) {
+/**
+ * crp_clear_halt() - count down and reset system
+ *
+ * Return: Nothing
+ */
+
+static void crp_clear_halt(int countdown) {
+	static char buf[] = "0...";
+	unsigned nsec;
+
+	for (nsec = 1; countdown && (nsec <= cr_host_state.clear_countdown); nsec++) {
+		buf[0] = '0' + nsec;
+		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, buf, 0x1f, 1);
+		cr_amd64_udelay(1000 * 1000);
+	}
 #if defined(DEBUG)
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "1...", 0x1f, 1);
-	cr_amd64_msleep(1000);
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "2...", 0x1f, 1);
-	cr_amd64_msleep(1000);
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "3...", 0x1f, 1);
-	cr_amd64_msleep(1000);
 	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur,
 		"halting CPU#0.", 0x1f, 1);
 	__asm(
 		"\t1:	hlt\n"
 		"\t	jmp	1b\n");
 #else
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "1...", 0x1f, 1);
-	cr_amd64_msleep(1000);
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "2...", 0x1f, 1);
-	cr_amd64_msleep(1000);
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "3...", 0x1f, 1);
-	cr_amd64_msleep(1000);
 	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur,
 		"resetting CPU#0.", 0x1f, 1);
+	cr_amd64_reset(&cr_host_state.clear_reset);
 	__asm("\tud2\n");
 #endif /* defined(DEBUG) */
 }
 
-void cr_clear_clear(void)
+/**
+ * cr_clear_clear() - zero-fill RAM
+ * @cpu:	per-CPU area of the calling CPU in the map
+ *
+ * Overwrite chunks taken from the per-NUMA node queues until all are empty
+ * or the deadline has passed, and verify them if enabled. The boot CPU
+ * releases the other clearing CPUs, waits for all of them to finish, prints
+ * the outcome, and resets the system. During a dry run, each CPU returns to
+ * the host with cr_clear_cpu_leave() once finished instead, and nothing is
+ * printed to the framebuffer.
+ *
+ * Return: Nothing
+ */
+
+void cr_clear_clear(struct crc_cpu *cpu)
 {
-	uintptr_t va_cur, vga_footer;
-	size_t unit, nbytes;
+	struct crc_queue *queue;
+	size_t nchunk, nchunks, nchunks_done;
+	unsigned long deadline_ms;
+	int nqueue, nid, expired;
 
-	cr_host_state.clear_va_vga_cur = (uintptr_t)cr_host_state.clear_vga;
-	for (va_cur = 0x0ULL, unit = PAGE_SIZE * CRA_PS_2M * 128;
-			va_cur < cr_host_state.clear_va_top; va_cur += unit) {
-		nbytes = unit - (va_cur & (unit - 1));
-		if (nbytes > (cr_host_state.clear_va_top - va_cur)) {
-			nbytes = cr_host_state.clear_va_top - va_cur;
+	if (cpu->ncpu == cr_host_state.clear_cpu_boot) {
+		cr_host_state.clear_tsc_start = cr_amd64_rdtsc();
+		cr_host_state.clear_va_vga_cur = (uintptr_t)cr_host_state.clear_vga;
+		cr_host_state.clear_va_vga_limit = (uintptr_t)cr_host_state.clear_vga
+			+ (2 * 80 * ((25 - 1) - crp_clear_vga_nbars() - CRC_VGA_STATUS_ROWS));
+		crp_clear_pattern_seed();
+		deadline_ms = cr_host_state.clear_deadline_ms;
+		if (cr_host_state.clear_dry_run
+		&&  (!deadline_ms || (deadline_ms > CRC_DRY_RUN_MS_MAX))) {
+			deadline_ms = CRC_DRY_RUN_MS_MAX;
+		}
+		cr_host_state.clear_tsc_deadline = deadline_ms
+			? (cr_amd64_rdtsc() + (deadline_ms * cr_host_state.clear_tsc_khz)) : 0;
+		crp_clear_telemetry_start();
+		crp_clear_serial_start();
+		__atomic_store_n(&cr_host_state.clear_cpus_go, 1, __ATOMIC_RELEASE);
+	} else {
+		while (!__atomic_load_n(&cr_host_state.clear_cpus_go, __ATOMIC_ACQUIRE)) {
+			__asm volatile("\tpause\n");
 		}
-		vga_footer = (uintptr_t)cr_host_state.clear_vga;
-		vga_footer += (2 * 80 * (25 - 1));
-		cr_clear_vga_print_hnum(&vga_footer, va_cur, 0x1f, 1);
-		crp_clear_clear_block(va_cur, nbytes);
-		cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, ".", 0x1f, 1);
 	}
-	cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "done, ", 0x1f, 1);
-	crp_clear_halt();
+	while (!(expired = crp_clear_deadline_expired())
+	&&     (queue = crp_clear_queue_next(cpu))) {
+		if (crp_clear_queue_take(queue, &queue->nchunk_next, &nchunk)) {
+			crp_clear_clear_chunk(cpu, queue, nchunk);
+			__atomic_add_fetch(&queue->nchunks_done, 1, __ATOMIC_RELAXED);
+		}
+	}
+	__asm volatile("\twbinvd\n" ::: "memory");	/* Write back WB/WT-mapped zeroes before verifying */
+	if (!expired && cr_host_state.clear_verify_stride
+	&&  (cr_host_state.clear_passes[cr_host_state.clear_npasses - 1] == CRC_PATTERN_ZERO)) {
+		__atomic_sub_fetch(&cr_host_state.clear_cpus_clearing, 1, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&cr_host_state.clear_cpus_clearing, __ATOMIC_ACQUIRE)
+		&&     !(expired = crp_clear_deadline_expired())) {
+			__asm volatile("\tpause\n");
+		}
+		for (nqueue = 0; !expired && (nqueue < CRHS_NODES_MAX); nqueue++) {
+			nid = (cpu->nid + nqueue) % CRHS_NODES_MAX;
+			queue = &cr_host_state.clear_queues[nid];
+			while (!(expired = crp_clear_deadline_expired())
+			&&     crp_clear_queue_take(queue, &queue->nchunk_verify_next, &nchunk)) {
+				crp_clear_verify_chunk(cpu, queue, nchunk);
+			}
+		}
+	}
+	cpu->tsc_done = cr_amd64_rdtsc();
+	__atomic_sub_fetch(&cr_host_state.clear_cpus_running, 1, __ATOMIC_RELEASE);
+	if (cr_host_state.clear_dry_run) {
+		cr_clear_cpu_leave(cpu);
+	} else
+	if (cpu->ncpu == cr_host_state.clear_cpu_boot) {
+		while (__atomic_load_n(&cr_host_state.clear_cpus_running, __ATOMIC_ACQUIRE)) {
+			__asm volatile("\tpause\n");
+		}
+		cr_host_state.clear_pattern_seed = 0;
+		crp_clear_telemetry_done(expired);
+		crp_clear_serial_done(expired);
+		if (expired) {
+			for (nid = 0, nchunks = 0, nchunks_done = 0; nid < CRHS_NODES_MAX; nid++) {
+				nchunks += cr_host_state.clear_queues[nid].nchunks;
+				nchunks_done += cr_host_state.clear_queues[nid].nchunks_done;
+			}
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "deadline expired, ", 0x1c, 1);
+			cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur, nchunks_done, 0x1f, 1);
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " of ", 0x1f, 1);
+			cr_clear_vga_print_hnum(&cr_host_state.clear_va_vga_cur, nchunks, 0x1f, 1);
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, " chunks cleared, ", 0x1f, 1);
+			crp_clear_print_latency();
+			crp_clear_print_flush();
+			crp_clear_print_pci();
+			crp_clear_halt(0);
+		} else {
+			cr_clear_vga_print_cstr(&cr_host_state.clear_va_vga_cur, "done, ", 0x1f, 1);
+			crp_clear_print_latency();
+			crp_clear_print_flush();
+			crp_clear_print_pci();
+			crp_clear_print_skips();
+			if (cr_host_state.clear_verify_stride
+			&&  (cr_host_state.clear_passes[cr_host_state.clear_npasses - 1] == CRC_PATTERN_ZERO)) {
+				crp_clear_print_verify();
+			}
+			crp_clear_halt(1);
+		}
+	} else {
+		__asm(
+			"\t1:	hlt\n"
+			"\t	jmp	1b\n");
+	}
 }
 
 /**
- * cr_clear_cpu_clear_exception() - XXX
+ * cr_clear_cpu_clear_exception() - handle exception raised by zero-filling kernel
  *
- * Return: 0 if instruction is to be skipped, 1 if instruction is to be restarted, <0 otherwise
+ * Resume the zero-filling kernel at the next page if any bytes remain to
+ * be zero-filled beyond the faulting page, otherwise abandon the current
+ * range. After CRC_FAULTS_2M_MAX faults within the same 2M region, skip to
+ * the next 2M boundary, and after CRC_SKIPS_2M_MAX such skips within the same
+ * 1G region, skip to the next 1G boundary, but never past the end of the run
+ * being zero-filled. Skipped ranges are recorded in the per-CPU area of the
+ * calling CPU and, unless during a dry run, whose pages are not part of the
+ * clear plan, marked in the skip bitmap and printed to the framebuffer. Each
+ * fault is written to the UART, if configured. The current VA and remaining
+ * count are taken from %rdi and %rcx as per the zero-filling kernel
+ * conventions in amd64def.h.
+ *
+ * Return: 1 (restart at updated instruction pointer)
  */
+static void crp_clear_cpu_skip_mark(uintptr_t va_base, uintptr_t va_limit) {
+	uintptr_t va_cur;
+	uint64_t mask;
+
+	for (va_cur = va_base; va_cur < va_limit;
+			va_cur = (va_cur & -(PAGE_SIZE * 64)) + (PAGE_SIZE * 64)) {
+		mask = -CRHS_SKIP_BIT(va_cur);
+		if (((va_cur & -(PAGE_SIZE * 64)) + (PAGE_SIZE * 64)) > va_limit) {
+			mask &= CRHS_SKIP_BIT(va_limit) - 1;
+		}
+		__atomic_fetch_or(CRHS_SKIP_MAP(va_cur), mask, __ATOMIC_RELAXED);
+	}
+}
+
+static uintptr_t crp_clear_cpu_fault_skip(struct crc_cpu *cpu, uintptr_t va, uintptr_t va_limit) {
+	uintptr_t va_page, va_skip;
+	struct crc_skip *skip;
+
+	va_page = va & -PAGE_SIZE;
+	va_skip = va_page + PAGE_SIZE;
+	if ((va_page & -(PAGE_SIZE * CRA_PS_2M)) != cpu->fault_va_2M) {
+		cpu->fault_va_2M = va_page & -(PAGE_SIZE * CRA_PS_2M);
+		cpu->nfaults_2M = 0;
+	}
+	if ((va_page & -(PAGE_SIZE * CRA_PS_1G)) != cpu->fault_va_1G) {
+		cpu->fault_va_1G = va_page & -(PAGE_SIZE * CRA_PS_1G);
+		cpu->nskips_2M = 0;
+	}
+	if (++cpu->nfaults_2M >= CRC_FAULTS_2M_MAX) {
+		va_skip = cpu->fault_va_2M + (PAGE_SIZE * CRA_PS_2M);
+		if (++cpu->nskips_2M >= CRC_SKIPS_2M_MAX) {
+			va_skip = cpu->fault_va_1G + (PAGE_SIZE * CRA_PS_1G);
+		}
+	}
+	if (va_skip > va_limit) {
+		va_skip = max(va_limit, va_page + PAGE_SIZE);
+	}
+	if ((cpu->nskips > 0)
+	&&  (cpu->skips[cpu->nskips - 1].va_limit == va_page)) {
+		cpu->skips[cpu->nskips - 1].va_limit = va_skip;
+	} else
+	if (cpu->nskips < CRC_SKIPS_MAX) {
+		skip = &cpu->skips[cpu->nskips++];
+		skip->va_base = va_page, skip->va_limit = va_skip;
+	}
+	cpu->nbytes_skipped += va_skip - va_page;
+	if (!cr_host_state.clear_dry_run) {
+		crp_clear_cpu_skip_mark(va_page, va_skip);	/* Within the run of this CPU only */
+	}
+	return va_skip;
+}
 
 int cr_clear_cpu_clear_exception(struct crc_cpu_regs *cpu_regs)
 {
-	uintptr_t vga_cur, rcx, rdi, vga_footer;
+	struct crc_cpu *cpu;
+	struct cra_clear_kernel *kernel;
+	uintptr_t vga_cur, vga_footer;
+	size_t nbytes, nbytes_skip;
 
-	vga_cur = cr_host_state.clear_va_vga_cur;
-	cr_clear_vga_print_cstr(&vga_cur, "!", 0x1f, 1);
-	vga_footer = (uintptr_t)cr_host_state.clear_vga;
-	vga_footer += (2 * 80 * (25 - 1));
-	cr_clear_vga_print_hnum(&vga_footer, cpu_regs->rdi, 0x1c, 1);
-	if (cpu_regs->rdi >= cr_host_state.clear_va_top) {
-		return 0;
+	cpu = cr_clear_cpu_self();
+	kernel = cpu->clear_kernel;
+	if (!cr_host_state.clear_dry_run) {
+		vga_cur = cr_host_state.clear_va_vga_cur;
+		cr_clear_vga_print_cstr(&vga_cur, "!", 0x1f, 1);
+		vga_footer = (uintptr_t)cr_host_state.clear_vga;
+		vga_footer += (2 * 80 * (25 - 1));
+		cr_clear_vga_print_hnum(&vga_footer, cpu_regs->rdi, 0x1c, 1);
+	}
+	nbytes = cpu_regs->rcx << kernel->rcx_shift;
+	nbytes_skip = crp_clear_cpu_fault_skip(cpu, cpu_regs->rdi,
+		cpu_regs->rdi + nbytes) - cpu_regs->rdi;
+	if (crp_clear_serial_begin("fault")) {
+		crp_clear_serial_field("cpu", cpu->ncpu);
+		crp_clear_serial_field("vecno", cpu_regs->vecno);
+		crp_clear_serial_field("va", cpu_regs->rdi);
+		crp_clear_serial_field("skip", nbytes_skip);
+		crp_clear_serial_end();
+	}
+	if ((cpu_regs->rdi >= cr_host_state.clear_va_top)
+	||  (nbytes <= nbytes_skip)) {
+		cpu_regs->orig_rip = (uintptr_t)kernel->rip_done;
 	} else {
-		rcx = cpu_regs->rcx & -(PAGE_SIZE/8);
-		rdi = cpu_regs->rdi & -(PAGE_SIZE);
-		if (rcx > (PAGE_SIZE/8)) {
-			cpu_regs->rcx = rcx + (PAGE_SIZE/8);
-			cpu_regs->rdi = rdi + (PAGE_SIZE);
-			return 1;
-		} else {
-			return 0;
-		}
+		cpu_regs->rdi += nbytes_skip;
+		cpu_regs->rcx = (nbytes - nbytes_skip) >> kernel->rcx_shift;
+		cpu_regs->orig_rip = (uintptr_t)kernel->rip_restart;
 	}
+	return 1;
 }
 
 /**
@@ -139,6 +1004,20 @@ int cr_clear_cpu_dump_regs(struct crc_cpu_regs *cpu_regs)
 
 	preg = (uintptr_t *)cpu_regs;
 	preg_name = crp_clear_cpu_reg_names;
+	if (crp_clear_serial_begin("exception")) {
+		crp_clear_serial_field("cpu", cr_clear_cpu_self()->ncpu);
+		crp_clear_serial_end();
+	}
+	for (nrow = 0; nrow < (sizeof(*cpu_regs) / sizeof(uintptr_t)); nrow += 4) {
+		if (crp_clear_serial_begin("regs")) {
+			for (ncol = 0; ncol < 4; ncol++) {
+				if (preg_name[nrow + ncol][0]) {
+					crp_clear_serial_field(preg_name[nrow + ncol], preg[nrow + ncol]);
+				}
+			}
+			crp_clear_serial_end();
+		}
+	}
 	cr_host_state.clear_va_vga_cur = (uintptr_t)cr_host_state.clear_vga;
 	for (nrow = 0; nrow < 25; nrow++) {
 		for (ncol = 0; ncol < 80; ncol += 8) {
@@ -181,33 +1060,156 @@ int cr_clear_cpu_dump_regs(struct crc_cpu_regs *cpu_regs)
 }
 
 /**
- * XXX
+ * cr_clear_cpu_entry{,_ap}() - switch boot CPU or other CPU to map and zero-fill RAM
+ *
+ * If a dry run was interrupted by stopping all CPUs, the chunk queues it
+ * replaced are restored first.
  *
  * Return: Nothing
  */
 
-static void crp_clear_cpu_entry(void) {
+static void crp_clear_cpu_entry(struct crc_cpu *cpu) {
 	cr_clear_vga_reset();
 	cr_clear_vga_clear();
-	cr_clear_clear();
+	cr_clear_clear(cpu);
 }
 void cr_clear_cpu_entry(void)
 {
+	int nid;
+
+	cr_clear_cpu_init();
 	cr_host_cpu_stop_all();
-	cr_clear_cpu_setup(crp_clear_cpu_entry);
+	if (cr_host_state.clear_dry_run) {
+		for (nid = 0; nid < CRHS_NODES_MAX; nid++) {
+			cr_host_state.clear_queues[nid] = cr_host_state.clear_dry_run_queues[nid];
+		}
+		cr_host_state.clear_nbytes_total = cr_host_state.clear_dry_run_nbytes_total;
+		cr_host_state.clear_dry_run = 0;
+	}
+	cr_host_pci_quiesce();
+	cr_clear_cpu_setup(CRHS_CPU_MAP(cr_host_state.clear_cpu_boot),
+		crp_clear_cpu_entry);
+}
+void cr_clear_cpu_entry_ap(int ncpu)
+{
+	cr_clear_cpu_setup(CRHS_CPU_MAP(ncpu), cr_clear_clear);
+}
+
+/**
+ * cr_clear_cpu_enter() - switch CPU to map and return to host once done
+ * @cpu_host:	per-CPU area of the calling CPU in the host
+ * @cpu:	per-CPU area of the calling CPU in the map
+ * @fn:		function to call with cpu once setup, which must eventually
+ *		call cr_clear_cpu_leave()
+ *
+ * Save the host CR3, descriptor table registers, segment selectors, FS and
+ * GS bases, PAT, callee-saved registers, and stack pointer of the calling
+ * CPU in its per-CPU area before switching to the map with
+ * cr_clear_cpu_setup(). The caller must have interrupts disabled.
+ *
+ * Return: Nothing, once fn has called cr_clear_cpu_leave()
+ */
+
+void cr_clear_cpu_enter(struct crc_cpu *cpu_host, struct crc_cpu *cpu, void (*fn)(struct crc_cpu *))
+{
+	cpu_host->host.self = (uintptr_t)cpu_host;
+	__asm volatile(
+		"\tsgdtq	%[gdtr]\n"
+		"\tsidtq	%[idtr]\n"
+		: [gdtr] "=m"(cpu_host->host.gdtr),
+		  [idtr] "=m"(cpu_host->host.idtr));
+	__asm volatile(
+		/*
+		 * %[host]:	cpu_host->host
+		 * %rax, %rcx, %rdx:	scratch
+		 */
+		"\tmovq		%%cr3,		%%rax\n"
+		"\tmovq		%%rax,		%c[cr3](%[host])\n"
+		"\tmovw		%%cs,		%c[cs](%[host])\n"
+		"\tmovw		%%ss,		%c[ss](%[host])\n"
+		"\tmovw		%%ds,		%c[ds](%[host])\n"
+		"\tmovw		%%es,		%c[es](%[host])\n"
+		"\tmovw		%%fs,		%c[fs](%[host])\n"
+		"\tmovw		%%gs,		%c[gs](%[host])\n"
+		"\tmovl		%[fs_base_msr],	%%ecx\n"
+		"\trdmsr\n"
+		"\tmovl		%%eax,		%c[fs_base](%[host])\n"
+		"\tmovl		%%edx,		%c[fs_base]+4(%[host])\n"
+		"\tmovl		%[gs_base_msr],	%%ecx\n"
+		"\trdmsr\n"
+		"\tmovl		%%eax,		%c[gs_base](%[host])\n"
+		"\tmovl		%%edx,		%c[gs_base]+4(%[host])\n"
+		"\tmovl		%[pat_msr],	%%ecx\n"
+		"\trdmsr\n"
+		"\tmovl		%%eax,		%c[pat](%[host])\n"
+		"\tmovl		%%edx,		%c[pat]+4(%[host])\n"
+		"\tpushq	%%rbp\n"
+		"\tpushq	%%rbx\n"
+		"\tpushq	%%r12\n"
+		"\tpushq	%%r13\n"
+		"\tpushq	%%r14\n"
+		"\tpushq	%%r15\n"
+		"\tpushq	$crp_clear_enter_return\n"
+		"\tmovq		%%rsp,		%c[rsp](%[host])\n"
+		"\tmovq		%[cpu],		%%rdi\n"
+		"\tmovq		%[fn],		%%rsi\n"
+		"\tcallq	cr_clear_cpu_setup\n"		/* Returns through cr_clear_cpu_leave() */
+		"crp_clear_enter_return:\n"
+		"\tpopq		%%r15\n"
+		"\tpopq		%%r14\n"
+		"\tpopq		%%r13\n"
+		"\tpopq		%%r12\n"
+		"\tpopq		%%rbx\n"
+		"\tpopq		%%rbp\n"
+		:: [host] "r"(&cpu_host->host),
+		   [cpu] "r"(cpu),
+		   [fn] "r"(fn),
+		   [cr3] "i"(offsetof(struct crc_cpu_host, cr3)),
+		   [rsp] "i"(offsetof(struct crc_cpu_host, rsp)),
+		   [pat] "i"(offsetof(struct crc_cpu_host, pat)),
+		   [fs_base] "i"(offsetof(struct crc_cpu_host, fs_base)),
+		   [gs_base] "i"(offsetof(struct crc_cpu_host, gs_base)),
+		   [cs] "i"(offsetof(struct crc_cpu_host, cs)),
+		   [ss] "i"(offsetof(struct crc_cpu_host, ss)),
+		   [ds] "i"(offsetof(struct crc_cpu_host, ds)),
+		   [es] "i"(offsetof(struct crc_cpu_host, es)),
+		   [fs] "i"(offsetof(struct crc_cpu_host, fs)),
+		   [gs] "i"(offsetof(struct crc_cpu_host, gs)),
+		   [fs_base_msr] "i"(CRA_FS_BASE_MSR),
+		   [gs_base_msr] "i"(CRA_GS_BASE_MSR),
+		   [pat_msr] "i"(CRA_PAT_MSR)
+		: "rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11", "memory");
 }
 
 /**
  * cr_clear_cpu_exception() - generic exception handler
  *
+ * NMIs, e.g. from perf or a watchdog, are counted and returned from at once,
+ * as the kernel handlers cannot run in the map, and are forwarded to the
+ * kernel after a dry run. Only #GP, #PF, and #MC raised while zero-filling
+ * are handled as clearing faults.
+ *
  * Return: 0 if instruction is to be skipped, 1 if instruction is to be restarted, <0 otherwise
  */
 
 int cr_clear_cpu_exception(struct crc_cpu_regs *cpu_regs)
 {
+	struct cr_telemetry *telemetry;
+	struct crc_cpu *cpu;
 	int status;
 
-	if (cr_host_state.clear_clear_flag) {	/* XXX not atomic */
+	cpu = cr_clear_cpu_self();
+	if (cpu_regs->vecno == CRA_VEC_NMI) {
+		cpu->nnmis++;
+		return 1;
+	}
+	if ((telemetry = crp_clear_telemetry())) {
+		__atomic_add_fetch(&telemetry->nexceptions, 1, __ATOMIC_RELAXED);
+	}
+	if (cpu->clear_flag
+	&&  ((cpu_regs->vecno == CRA_VEC_GP)
+	||   (cpu_regs->vecno == CRA_VEC_PF)
+	||   (cpu_regs->vecno == CRA_VEC_MC))) {
 		status = cr_clear_cpu_clear_exception(cpu_regs);
 	} else {
 		status = cr_clear_cpu_dump_regs(cpu_regs);
@@ -217,7 +1219,7 @@ int cr_clear_cpu_exception(struct crc_cpu_regs *cpu_regs)
 	case 1: break;
 	default:
 #if !defined(DEBUG)
-		cr_amd64_msleep(1000);
+		cr_amd64_udelay(1000 * 1000);
 #else
 		break;
 #endif /* !defined(DEBUG) */
@@ -226,12 +1228,12 @@ int cr_clear_cpu_exception(struct crc_cpu_regs *cpu_regs)
 }
 
 /**
- * cr_clear_cpu_setup() - setup CPU
+ * cr_clear_cpu_init() - initialise CR3, GDTR, and IDTR values shared by all CPUs
  *
  * Return: Nothing
  */
 
-void cr_clear_cpu_setup(void (*fn)(void))
+void cr_clear_cpu_init(void)
 {
 	CRA_INIT_CR3(&cr_host_state.clear_cr3, CRA_CR3_WRITE_THROUGH,
 		cr_host_virt_to_phys((uintptr_t)cr_host_state.clear_pml4));
@@ -239,23 +1241,143 @@ void cr_clear_cpu_setup(void (*fn)(void))
 		sizeof(struct cra_gdt_ent) * 3);
 	CRA_INIT_IDTR(&cr_host_state.clear_idtr, (uintptr_t)cr_host_state.clear_idt,
 		PAGE_SIZE - 1);
+}
+
+/**
+ * cr_clear_cpu_leave() - switch CPU back from map to host
+ * @cpu:	per-CPU area of the calling CPU in the map
+ *
+ * Restore the host state saved by cr_clear_cpu_enter() and return from it.
+ * The host stack pointer is loaded immediately after switching CR3 as the
+ * per-CPU area in the map is no longer mapped, and the host CS is reloaded
+ * with a far return before the host IDT, segment selectors, FS and GS
+ * bases, and PAT are restored through the host VA of the per-CPU area.
+ *
+ * Return: Nothing
+ */
+
+void __attribute__((noreturn)) cr_clear_cpu_leave(struct crc_cpu *cpu)
+{
+	__asm volatile(
+		/*
+		 * %rax:	host CR3; host CS
+		 * %rbx:	host VA of cpu->host
+		 * %rdx:	host stack pointer
+		 * %r8:		%cr4
+		 * %r9:		%cr4 &= ~(PGE bit)
+		 */
+		"\tcli\n"
+		"\tmovq		%c[self](%[host]),	%%rbx\n"
+		"\taddq		%[host_off],	%%rbx\n"
+		"\tmovq		%c[cr3](%[host]),	%%rax\n"
+		"\tmovq		%c[rsp](%[host]),	%%rdx\n"
+		"\tlgdtq	%c[gdtr](%[host])\n"
+		"\tmovq		%%cr4,		%%r8\n"
+		"\tmovq		%%r8,		%%r9\n"		/* Copy original CR4 value */
+		"\tandb		$0x7f,		%%r9b\n"	/* Clear PGE bit */
+		"\tmovq		%%r9,		%%cr4\n"	/* Disable PGE */
+		"\tmovq		%%rax,		%%cr3\n"	/* Set host CR3 */
+		"\tmovq		%%r8,		%%cr4\n"	/* Enable PGE */
+		"\tmovq		%%rdx,		%%rsp\n"
+		"\tmovzwq	%c[cs](%%rbx),	%%rax\n"
+		"\tpushq	%%rax\n"
+		"\tpushq	$crp_clear_leave_start\n"
+		"\tlretq\n"
+		"crp_clear_leave_start:\n"
+		"\tlidtq	%c[idtr](%%rbx)\n"
+		"\tmovw		%c[ss](%%rbx),	%%ss\n"
+		"\tmovw		%c[ds](%%rbx),	%%ds\n"
+		"\tmovw		%c[es](%%rbx),	%%es\n"
+		"\tmovw		%c[fs](%%rbx),	%%fs\n"
+		"\tmovw		%c[gs](%%rbx),	%%gs\n"
+		"\tmovl		%[fs_base_msr],	%%ecx\n"
+		"\tmovl		%c[fs_base](%%rbx),	%%eax\n"
+		"\tmovl		%c[fs_base]+4(%%rbx),	%%edx\n"
+		"\twrmsr\n"
+		"\tmovl		%[gs_base_msr],	%%ecx\n"
+		"\tmovl		%c[gs_base](%%rbx),	%%eax\n"
+		"\tmovl		%c[gs_base]+4(%%rbx),	%%edx\n"
+		"\twrmsr\n"
+		"\tmovl		%[pat_msr],	%%ecx\n"
+		"\tmovl		%c[pat](%%rbx),	%%eax\n"
+		"\tmovl		%c[pat]+4(%%rbx),	%%edx\n"
+		"\twrmsr\n"
+		"\tretq\n"				/* Return to cr_clear_cpu_enter() */
+		:: [host] "r"(&cpu->host),
+		   [host_off] "i"(offsetof(struct crc_cpu, host)),
+		   [self] "i"(offsetof(struct crc_cpu_host, self)),
+		   [cr3] "i"(offsetof(struct crc_cpu_host, cr3)),
+		   [rsp] "i"(offsetof(struct crc_cpu_host, rsp)),
+		   [pat] "i"(offsetof(struct crc_cpu_host, pat)),
+		   [fs_base] "i"(offsetof(struct crc_cpu_host, fs_base)),
+		   [gs_base] "i"(offsetof(struct crc_cpu_host, gs_base)),
+		   [cs] "i"(offsetof(struct crc_cpu_host, cs)),
+		   [ss] "i"(offsetof(struct crc_cpu_host, ss)),
+		   [ds] "i"(offsetof(struct crc_cpu_host, ds)),
+		   [es] "i"(offsetof(struct crc_cpu_host, es)),
+		   [fs] "i"(offsetof(struct crc_cpu_host, fs)),
+		   [gs] "i"(offsetof(struct crc_cpu_host, gs)),
+		   [gdtr] "i"(offsetof(struct crc_cpu_host, gdtr)),
+		   [idtr] "i"(offsetof(struct crc_cpu_host, idtr)),
+		   [fs_base_msr] "i"(CRA_FS_BASE_MSR),
+		   [gs_base_msr] "i"(CRA_GS_BASE_MSR),
+		   [pat_msr] "i"(CRA_PAT_MSR)
+		: "rax", "rbx", "rcx", "rdx", "r8", "r9", "memory");
+	__builtin_unreachable();
+}
+
+/**
+ * cr_clear_cpu_self() - get per-CPU area of the calling CPU in the map
+ *
+ * Only valid once the calling CPU has been setup with cr_clear_cpu_setup().
+ *
+ * Return: Pointer to per-CPU area
+ */
+
+struct crc_cpu *cr_clear_cpu_self(void)
+{
+	uintptr_t rsp;
+
+	__asm volatile(
+		"\tmovq		%%rsp,		%[rsp]\n"
+		: [rsp] "=r"(rsp));
+	return (struct crc_cpu *)(rsp & -CRHS_CPU_SIZE);
+}
+
+/**
+ * cr_clear_cpu_setup() - setup CPU
+ * @cpu:	per-CPU area of the calling CPU in the map
+ * @fn:		function to call with cpu once setup
+ *
+ * Return: Nothing
+ */
+
+void cr_clear_cpu_setup(struct crc_cpu *cpu, void (*fn)(struct crc_cpu *))
+{
 	__asm volatile(
 		/*
 		 * %rax:	cr_host_state.clear_cr3
 		 * %rbx:	&cr_host_state.clear_gdtr
 		 * %rcx:	&cr_host_state.clear_idtr
-		 * %rdx:	&cr_host_state.clear_stack[-1]
+		 * %rdx:	top of per-CPU area
 		 * %rsi:	fn
+		 * %rdi:	cpu
 		 * %r8:		%cr4; [DEFG]S segment selector 1
 		 * %r9:		%cr4 &= ~(PGE bit)
 		 */
 		"\tcli\n"					/* Disable interrupts */
 		"\tcld\n"					/* Clear direction flag */
+		"\twbinvd\n"					/* Write back caches */
+		"\tmovl		%[pat_msr],	%%ecx\n"
+		"\tmovl		%[pat_lo],	%%eax\n"
+		"\tmovl		%[pat_hi],	%%edx\n"
+		"\twrmsr\n"					/* Set PAT */
 		"\tmovq		%[cr3],		%%rax\n"
 		"\tmovq		%[gdtr],	%%rbx\n"
 		"\tmovq		%[idtr],	%%rcx\n"
 		"\tmovq		%[stack_top],	%%rdx\n"
 		"\tmovq		%[fn_next],	%%rsi\n"
+		"\tmovq		%[cpu],		%%rdi\n"
 		"\tmovq		%%cr4,		%%r8\n"
 		"\tmovq		%%r8,		%%r9\n"		/* Copy original CR4 value */
 		"\tandb		$0x7f,		%%r9b\n"	/* Clear PGE bit */
@@ -283,9 +1405,161 @@ void cr_clear_cpu_setup(void (*fn)(void))
 		:: [cr3] "r"(cr_host_state.clear_cr3),
 		   [gdtr] "r"(&cr_host_state.clear_gdtr),
 		   [idtr] "r"(&cr_host_state.clear_idtr),
-		   [stack_top] "r"(&cr_host_state.clear_stack[CRHS_STACK_PAGES * (PAGE_SIZE / sizeof(cr_host_state.clear_stack[0]))]),
-		   [fn_next] "r"(fn)
-		: "rax", "rbx", "rcx", "rdx", "rsi", "memory");
+		   [stack_top] "r"((uintptr_t)cpu + CRHS_CPU_SIZE),
+		   [fn_next] "r"(fn),
+		   [cpu] "r"(cpu),
+		   [pat_msr] "i"(CRA_PAT_MSR),
+		   [pat_lo] "i"((uint32_t)CRA_PAT_VALUE),
+		   [pat_hi] "i"((uint32_t)(CRA_PAT_VALUE >> 32))
+		: "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "memory");
+}
+
+/**
+ * cr_clear_passes_parse() - parse comma-separated list of overwrite patterns
+ * @str:	list of CRC_PATTERN_NAMES, terminated by NUL, newline, or len
+ * @len:	maximum length of str
+ * @passes:	pointer to array of CRC_PASSES_MAX overwrite patterns
+ * @pnpasses:	pointer to number of overwrite passes
+ *
+ * Return: 0 on success, <0 on failure
+ */
+
+int cr_clear_passes_parse(const char *str, size_t len, enum crc_pattern *passes, size_t *pnpasses)
+{
+	size_t ntoken, npattern, npasses;
+
+	for (npasses = 0; len && *str && (*str != '\n');) {
+		for (ntoken = 0; (ntoken < len) && str[ntoken]
+				&& (str[ntoken] != ',') && (str[ntoken] != '\n'); ntoken++) {
+		}
+		for (npattern = 0; npattern < (sizeof(crp_clear_pattern_names)
+				/ sizeof(crp_clear_pattern_names[0])); npattern++) {
+			if ((strlen(crp_clear_pattern_names[npattern]) == ntoken)
+			&&  !strncmp(crp_clear_pattern_names[npattern], str, ntoken)) {
+				break;
+			}
+		}
+		if ((npattern == (sizeof(crp_clear_pattern_names)
+				/ sizeof(crp_clear_pattern_names[0])))
+		||  (npasses >= CRC_PASSES_MAX)) {
+			return -EINVAL;
+		} else {
+			passes[npasses++] = npattern;
+		}
+		str += ntoken, len -= ntoken;
+		if (len && (*str == ',')) {
+			str++, len--;
+		}
+	}
+	if (npasses == 0) {
+		return -EINVAL;
+	} else {
+		return *pnpasses = npasses, 0;
+	}
+}
+
+/**
+ * cr_clear_plan_init() - split clear plan into per-NUMA node chunk queues
+ * @plan:	clear plan entries sorted by NUMA node, within the clear plan
+ * @nplan:	number of clear plan entries
+ *
+ * Split each clear plan entry into chunks of cr_host_state.clear_chunk_size
+ * bytes aligned to its VA and assign each node the range of clear plan
+ * entries and chunks local to it. The total bytes to clear, from which the
+ * VGA footer derives the ETA, are summed here rather than at trigger time.
+ *
+ * Return: Nothing
+ */
+
+void cr_clear_plan_init(struct crc_plan_ent *plan, size_t nplan)
+{
+	struct crc_plan_ent *ent;
+	struct crc_queue *queue;
+	size_t nent, unit;
+	int nid;
+
+	for (nid = 0; nid < CRHS_NODES_MAX; nid++) {
+		CRC_INIT_QUEUE(&cr_host_state.clear_queues[nid]);
+	}
+	cr_host_state.clear_nbytes_total = 0;
+	for (nent = 0, unit = cr_host_state.clear_chunk_size; nent < nplan; nent++) {
+		ent = &plan[nent];
+		cr_host_state.clear_nbytes_total += ent->nbytes;
+		queue = &cr_host_state.clear_queues[ent->nid];
+		if (queue->nents == 0) {
+			queue->nent_base = ent - CRHS_PLAN_HOST(0);
+		}
+		queue->nents++;
+		ent->nchunk_base = queue->nchunks;
+		ent->nchunks = (((ent->va + ent->nbytes + unit - 1) & -unit)
+			- (ent->va & -unit)) / unit;
+		queue->nchunks += ent->nchunks;
+	}
+}
+
+/**
+ * cr_clear_serial_{init,print_cstr,print_hnum}() - polled 16550 UART output
+ *
+ * Program the UART at cr_host_state.clear_serial_port for 115200 baud, 8N1,
+ * enabled FIFOs, and disabled interrupts, and write strings, with newlines
+ * expanded to CR LF, and hexadecimal numbers as printed by
+ * cr_clear_vga_print_hnum() to it, polling the line status register for
+ * an empty transmitter holding register before each character.
+ *
+ * Return: Nothing
+ */
+
+static void crp_clear_serial_putc(char c) {
+	unsigned short port;
+	size_t npoll;
+
+	port = cr_host_state.clear_serial_port;
+	for (npoll = 0; (npoll < CRC_SERIAL_POLLS_MAX)
+			&& !(cr_amd64_inb(port + 5) & 0x20); npoll++) {
+		__asm volatile("\tpause\n");
+	}
+	cr_amd64_outb(port, c);
+}
+
+void cr_clear_serial_init(void)
+{
+	unsigned short port;
+
+	port = cr_host_state.clear_serial_port;
+	cr_amd64_outb(port + 1, 0x00);			/* Disable interrupts */
+	cr_amd64_outb(port + 3, 0x80);			/* Set DLAB */
+	cr_amd64_outb(port + 0, CRC_SERIAL_DIVISOR & 0xff);
+	cr_amd64_outb(port + 1, (CRC_SERIAL_DIVISOR >> 8) & 0xff);
+	cr_amd64_outb(port + 3, 0x03);			/* 8 data bits, no parity, 1 stop bit */
+	cr_amd64_outb(port + 2, 0xc7);			/* Enable and clear FIFOs */
+	cr_amd64_outb(port + 4, 0x03);			/* Set DTR and RTS */
+}
+
+void cr_clear_serial_print_cstr(const char *str)
+{
+	while (*str) {
+		if (*str == '\n') {
+			crp_clear_serial_putc('\r');
+		}
+		crp_clear_serial_putc(*str++);
+	}
+}
+
+void cr_clear_serial_print_hnum(uintptr_t u64)
+{
+	static char hex_tbl[16] = {
+		'0', '1', '2', '3', '4',
+		'5', '6', '7', '8', '9',
+		'a', 'b', 'c', 'd', 'e',
+		'f',
+	};
+	size_t ndigit;
+
+	crp_clear_serial_putc('0');
+	crp_clear_serial_putc('x');
+	for (ndigit = 0; ndigit < 16; ndigit++) {
+		crp_clear_serial_putc(hex_tbl[(u64 >> ((16 - ndigit - 1) * 4)) & 0xf]);
+	}
 }
 
 /**
@@ -303,6 +1577,25 @@ void cr_clear_vga_clear(void)
 	}
 }
 
+/**
+ * cr_clear_vga_print_bar() - print progress bar of n out of nmax
+ *
+ * Return: Nothing
+ */
+
+void cr_clear_vga_print_bar(uintptr_t *pva_vga_cur, size_t n, size_t nmax, size_t width, unsigned char attr)
+{
+	unsigned char *p = (unsigned char *)*pva_vga_cur;
+	size_t ncell, nfull;
+
+	nfull = nmax ? ((min(n, nmax) * width) / nmax) : width;
+	for (ncell = 0; ncell < width; ncell++) {
+		*p++ = (ncell < nfull) ? 0xdb : 0xb0;	/* CP437 full block, light shade */
+		*p++ = attr;
+	}
+	*pva_vga_cur = (uintptr_t)p;
+}
+
 /**
  * XXX
  */
@@ -357,6 +1650,36 @@ void cr_clear_vga_print_hnum(uintptr_t *pva_vga_cur, uintptr_t u64, unsigned cha
 }
 
 
+/**
+ * cr_clear_vga_print_dnum() - print u64 in decimal, zero-padded to at least ndigits digits
+ *
+ * Return: Nothing
+ */
+
+void cr_clear_vga_print_dnum(uintptr_t *pva_vga_cur, uintptr_t u64, size_t ndigits, unsigned char attr, size_t align)
+{
+	char buf[sizeof("18446744073709551615")];
+	unsigned char *p = (unsigned char *)*pva_vga_cur;
+	size_t ndigit;
+
+	ndigit = 0;
+	do {
+		buf[ndigit++] = '0' + (u64 % 10);
+		u64 /= 10;
+	} while ((u64 || (ndigit < ndigits)) && (ndigit < sizeof(buf)));
+	while (ndigit > 0) {
+		*p++ = buf[--ndigit];
+		*p++ = attr;
+	}
+	if (((uintptr_t)p & 0xfff) % (align * 2)) {
+		p = (unsigned char *)(((uintptr_t)p & ~0xfff) |
+			(((uintptr_t)p & 0xfff) +
+				((align * 2) - (((uintptr_t)p & 0xfff) % (align * 2)))));
+	}
+	*pva_vga_cur = (uintptr_t)p;
+}
+
+
 /**
  * XXX
  */
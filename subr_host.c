@@ -82,6 +82,12 @@ static int crp_host_map_link_page(enum crh_ptl_type type, uintptr_t pfn, uintptr
 	if (type & CRH_PTL_RSVD_PAGE) {
 		(*leaf)->type |= CRH_PTL_RSVD_PAGE;
 		(*leaf)->va_rsvd = va;
+		if ((err = cr_host_list_append(&cr_host_state.host_lrsvd,
+				(void **)&item)) < 0) {
+			return err;
+		} else {
+			CRH_LRSVD_ITEM_INIT(item, pfn);
+		}
 	}
 	return 0;
 }